@@ -12,6 +12,11 @@
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QDateTime>
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QTimeZone>
+#include <QUuid>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent), authToken("")
@@ -93,9 +98,30 @@ void MainWindow::setupUI() {
     )");
     connect(createPostButton, &QPushButton::clicked, this, &MainWindow::onCreatePostClicked);
 
+    loadFeedButton = new QPushButton("Load Feed", this);
+    loadFeedButton->setStyleSheet(R"(
+        QPushButton {
+            background-color: #17a2b8;
+            color: white;
+            padding: 6px 12px;
+            border-radius: 4px;
+            font-weight: bold;
+        }
+        QPushButton:hover {
+            background-color: #138496;
+        }
+    )");
+    connect(loadFeedButton, &QPushButton::clicked, this, &MainWindow::onLoadFeedClicked);
+
+    // CBOR: картинки приходят байтами, без base64.
+    binaryFeedCheck = new QCheckBox("Binary feed", this);
+    binaryFeedCheck->setChecked(true);
+
     topBarLayout->addWidget(loginButton);
     topBarLayout->addWidget(registerButton);
     topBarLayout->addWidget(createPostButton);
+    topBarLayout->addWidget(loadFeedButton);
+    topBarLayout->addWidget(binaryFeedCheck);
 
     mainLayout->addLayout(topBarLayout);
 
@@ -308,6 +334,8 @@ void MainWindow::onCreatePostClicked() {
         QNetworkRequest request(url);
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
         request.setRawHeader("Authorization", "Bearer " + authToken.toUtf8());
+        // Один ключ на отправку формы: повтор запроса не создаст второй пост.
+        request.setRawHeader("Idempotency-Key", QUuid::createUuid().toByteArray(QUuid::WithoutBraces));
 
         QJsonObject json;
         json["content"] = description;
@@ -537,4 +565,67 @@ void MainWindow::onSignInReplyFinished(QNetworkReply *reply) {
 
     QMessageBox::information(this, title, message);
     reply->deleteLater();
+}
+
+void MainWindow::onLoadFeedClicked() {
+    if (authToken.isEmpty()) {
+        QMessageBox::warning(this, "Not authorized", "Please login first");
+        return;
+    }
+
+    bool cbor = binaryFeedCheck->isChecked();
+    QUrl url("http://127.0.0.1:8000/api/posts/feed?limit=10");
+    QNetworkRequest request(url);
+    request.setRawHeader("Authorization", "Bearer " + authToken.toUtf8());
+    request.setRawHeader("Accept", cbor ? "application/cbor" : "application/json");
+    request.setTransferTimeout(5000);
+
+    QNetworkReply *reply = networkManager->get(request);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        if (reply->error() == QNetworkReply::NoError) {
+            QString type = reply->header(QNetworkRequest::ContentTypeHeader).toString();
+            showFeed(reply->readAll(), type.startsWith("application/cbor"));
+        } else {
+            QMessageBox::warning(this, "Failed", "Failed to load feed: " + reply->errorString());
+        }
+        reply->deleteLater();
+    });
+}
+
+void MainWindow::showFeed(const QByteArray &body, bool cbor) {
+    QStringList lines;
+    lines << QString("Feed (%1, %2 bytes)").arg(cbor ? "cbor" : "json").arg(body.size());
+
+    if (cbor) {
+        const QCborArray posts = QCborValue::fromCbor(body).toArray();
+        for (const QCborValue &value : posts) {
+            QCborMap post = value.toMap();
+            QDateTime createdAt = QDateTime::fromMSecsSinceEpoch(
+                post[QStringLiteral("createdAt")].toInteger() / 1000, QTimeZone::UTC);
+            qint64 imageBytes = 0;
+            for (const QCborValue &img : post[QStringLiteral("img")].toArray()) {
+                imageBytes += img.toByteArray().size();
+            }
+            lines << QString("%1  %2  images: %3 bytes\n  %4")
+                         .arg(post[QStringLiteral("author")].toString(),
+                              createdAt.toString(Qt::ISODate))
+                         .arg(imageBytes)
+                         .arg(post[QStringLiteral("content")].toString());
+        }
+    } else {
+        const QJsonArray posts = QJsonDocument::fromJson(body).array();
+        for (const QJsonValue &value : posts) {
+            QJsonObject post = value.toObject();
+            qint64 imageBytes = 0;
+            for (const QJsonValue &img : post["img"].toArray()) {
+                imageBytes += QByteArray::fromBase64(img.toString().toLatin1()).size();
+            }
+            lines << QString("%1  %2  images: %3 bytes\n  %4")
+                         .arg(post["author"].toString(), post["createdAt"].toString())
+                         .arg(imageBytes)
+                         .arg(post["content"].toString());
+        }
+    }
+
+    responseText->setText(lines.join("\n"));
 }
\ No newline at end of file
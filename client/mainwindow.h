@@ -7,6 +7,7 @@
 #include <QTimer>
 #include <QLabel>
 #include <QPushButton>
+#include <QCheckBox>
 #include <QTextEdit>
 #include <QDateTime>
 
@@ -24,6 +25,7 @@ private slots:
     void onSignInClicked();
     void onRegisterClicked();
     void onCreatePostClicked();
+    void onLoadFeedClicked();
     void onAuthReplyFinished(QNetworkReply *reply);
     void onSignInReplyFinished(QNetworkReply *reply);
 
@@ -38,6 +40,8 @@ private:
     QPushButton *loginButton;
     QPushButton *registerButton;
     QPushButton *createPostButton;
+    QPushButton *loadFeedButton;
+    QCheckBox *binaryFeedCheck;
 
     QString authToken;
 
@@ -47,6 +51,7 @@ private:
     void showSignInDialog(const QString &mode);
     void sendAuthRequest(const QString &nickname, const QString &login, const QString &password, const QString &email, const QString &phone, bool isPublic, const QString &mode);
     void sendSignInRequest(const QString &login, const QString &password);
+    void showFeed(const QByteArray &body, bool cbor);
 };
 
 #endif // MAINWINDOW_H
\ No newline at end of file
@@ -0,0 +1,190 @@
+// Выделения памяти в куче на запрос создания поста: прежний обработчик на
+// вложенных колбэках против корутины. База и сеть не участвуют, повторяется
+// только работа обработчика с телом запроса: копии tags и img в захваты
+// лямбд и в saveImages, std::function на каждое продолжение, сборка ответа.
+// Счетчик — перехваченный malloc glibc. Счетчики RequestArena в работающем
+// сервере видят только operator new и не учитывают строки jsoncpp.
+//
+//   cmake -DPRIYOMYSH_BUILD_BENCH=ON .. && make alloc_bench
+//   ./alloc_bench [images] [image_kb]
+#include <json/json.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace {
+
+uint64_t allocations = 0;
+uint64_t allocatedBytes = 0;
+
+}  // namespace
+
+// jsoncpp хранит строки Json::Value в памяти из malloc, мимо operator new,
+// поэтому считается сам malloc (glibc): через него идет и operator new.
+extern "C" void *__libc_malloc(std::size_t size);
+
+extern "C" void *malloc(std::size_t size) {
+    ++allocations;
+    allocatedBytes += size;
+    return __libc_malloc(size);
+}
+
+namespace {
+
+using Callback = std::function<void(const std::string &)>;
+
+std::shared_ptr<Json::Value> makeBody(size_t images, size_t imageBytes) {
+    auto body = std::make_shared<Json::Value>();
+    (*body)["content"] = std::string(300, 'c');
+    for (int i = 0; i < 5; ++i) {
+        (*body)["tags"].append("tag" + std::to_string(i));
+    }
+    (*body)["img"] = Json::Value(Json::arrayValue);
+    for (size_t i = 0; i < images; ++i) {
+        (*body)["img"].append(std::string(imageBytes / 3 * 4, 'A' + i % 26));
+    }
+    return body;
+}
+
+std::string writeJson(const Json::Value &value) {
+    static const Json::StreamWriterBuilder writer = [] {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        return builder;
+    }();
+    return Json::writeString(writer, value);
+}
+
+size_t sink = 0;
+
+// Как saveImages до корутин: массив по ссылке, колбэк по значению, base64
+// каждой картинки копируется перед записью.
+void saveImagesBefore(
+    int postId,
+    const Json::Value &imgArray,
+    const Json::Value &post,
+    Callback callback
+) {
+    for (const auto &img : imgArray) {
+        std::string base64 = img.asString();
+        sink += base64.size() + postId;
+    }
+    callback(writeJson(post));
+}
+
+// Прежний newPost: продолжение verifyToken и колбэк INSERT хранятся в
+// std::function, tags и img копируются из тела в локальные переменные и
+// еще раз в захват колбэка INSERT.
+void newPostBefore(const std::shared_ptr<Json::Value> &req, Callback callback) {
+    std::function<void(std::optional<std::string>)> verified =
+        [callback, req](std::optional<std::string> loginOpt) {
+            std::string login = *loginOpt;
+            auto content = (*req)["content"].asString();
+            auto tags = (*req)["tags"];
+            auto imgArray = req->get("img", Json::arrayValue);
+            std::string createdAt = "2026-10-19T12:00:00";
+            std::function<void(int)> inserted =
+                [callback, tags, createdAt, login, content,
+                 imgArray](int postId) {
+                    for (const auto &tag : tags) {
+                        std::string param = tag.asString();
+                        sink += param.size();
+                    }
+                    Json::Value post;
+                    post["id"] = "0190a5c4-3b1e-7d2a-9f3c-1a2b3c4dfd00";
+                    post["content"] = content;
+                    post["author"] = login;
+                    for (const auto &tag : tags) {
+                        post["tags"].append(tag.asString());
+                    }
+                    post["createdAt"] = createdAt;
+                    post["likesCount"] = 0;
+                    post["dislikesCount"] = 0;
+                    saveImagesBefore(postId, imgArray, post, callback);
+                };
+            inserted(1);
+        };
+    verified(std::string("author1"));
+}
+
+// Текущий newPost: tags и img читаются по ссылке из тела, которое держит
+// кадр корутины; параметры запроса — литералы массивов Postgres.
+void newPostAfter(const std::shared_ptr<Json::Value> &req, Callback &callback) {
+    std::string login = "author1";
+    const Json::Value &body = *req;
+    auto content = body["content"].asString();
+    const Json::Value &tags = body["tags"];
+    const Json::Value &imgArray = body["img"];
+
+    std::string paths = "{", hashes = "{";
+    for (const auto &img : imgArray) {
+        std::string base64 = img.asString();
+        sink += base64.size();
+        paths += "\"../media/ab/cd/abcd.jpg\",";
+        hashes += "\"abcd\",";
+    }
+    std::string tagArray = "{";
+    for (const auto &tag : tags) {
+        tagArray += '"';
+        tagArray += tag.asString();
+        tagArray += "\",";
+    }
+    sink += paths.size() + hashes.size() + tagArray.size();
+
+    Json::Value post;
+    post["id"] = "0190a5c4-3b1e-7d2a-9f3c-1a2b3c4dfd00";
+    post["content"] = std::move(content);
+    post["author"] = std::move(login);
+    for (const auto &tag : tags) {
+        post["tags"].append(tag.asString());
+    }
+    post["createdAt"] = "2026-10-19T12:00:00.000000Z";
+    post["likesCount"] = 0;
+    post["dislikesCount"] = 0;
+    callback(writeJson(post));
+}
+
+struct Measured {
+    double allocations;
+    double bytes;
+};
+
+template <typename F>
+Measured measure(int runs, F &&f) {
+    uint64_t startAllocations = allocations, startBytes = allocatedBytes;
+    for (int i = 0; i < runs; ++i) {
+        f();
+    }
+    return {
+        double(allocations - startAllocations) / runs,
+        double(allocatedBytes - startBytes) / runs
+    };
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t images = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 3;
+    size_t imageKb = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+    const int runs = 1000;
+    auto req = makeBody(images, imageKb * 1024);
+    Callback callback = [](const std::string &response) {
+        sink += response.size();
+    };
+
+    auto before = measure(runs, [&] { newPostBefore(req, callback); });
+    auto after = measure(runs, [&] { newPostAfter(req, callback); });
+
+    std::printf("newPost, %zu images of %zu KB, per request\n", images,
+                imageKb);
+    std::printf("%-10s %12s %14s\n", "handler", "allocations", "bytes");
+    std::printf("%-10s %12.1f %14.0f\n", "callbacks", before.allocations,
+                before.bytes);
+    std::printf("%-10s %12.1f %14.0f\n", "coroutine", after.allocations,
+                after.bytes);
+    return sink == 0;
+}
\ No newline at end of file
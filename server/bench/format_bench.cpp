@@ -0,0 +1,295 @@
+// Сравнение JSON и CBOR для ленты: размер ответа и время кодирования и
+// декодирования. Посты синтетические, по форме как у /api/posts/feed.
+// Отдельно замеряется разбор created_at из строки результата: прежний
+// текстовый timestamp против целого числа микросекунд.
+//
+//   cmake -DPRIYOMYSH_BUILD_BENCH=ON .. && make format_bench
+//   ./format_bench [posts] [image_kb]
+#include <drogon/utils/Utilities.h>
+#include <json/json.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "codec/Cbor.h"
+#include "codec/Timestamp.h"
+
+namespace {
+
+struct Post {
+    std::string id;
+    std::string content;
+    std::string author;
+    std::vector<std::string> tags;
+    std::vector<std::string> images;
+    std::string createdAt;
+    int64_t createdAtUs;
+    int64_t likes;
+    int64_t dislikes;
+};
+
+std::vector<Post> makePosts(size_t count, size_t imageBytes) {
+    std::mt19937 rng(42);
+    std::vector<Post> posts(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto &post = posts[i];
+        post.id = "0b7e6f1c-3d2a-4f5e-8a9b-" + std::to_string(100000000000 + i);
+        post.content = std::string(200, 'a' + i % 26);
+        post.author = "user" + std::to_string(i % 50);
+        post.tags = {"news", "tag" + std::to_string(i % 7), "misc"};
+        std::string image(imageBytes, '\0');
+        for (auto &c : image) {
+            c = static_cast<char>(rng());
+        }
+        post.images.push_back(std::move(image));
+        post.createdAtUs = 1792413296123456 + i;
+        post.createdAt = formatIsoTimestampUs(post.createdAtUs);
+        post.likes = i * 3;
+        post.dislikes = i;
+    }
+    return posts;
+}
+
+std::string encodeJson(const std::vector<Post> &posts) {
+    Json::Value root(Json::arrayValue);
+    for (const auto &post : posts) {
+        Json::Value value;
+        value["id"] = post.id;
+        value["content"] = post.content;
+        value["author"] = post.author;
+        for (const auto &tag : post.tags) {
+            value["tags"].append(tag);
+        }
+        for (const auto &image : post.images) {
+            value["img"].append(drogon::utils::base64Encode(image));
+        }
+        value["createdAt"] = post.createdAt;
+        value["likesCount"] = (Json::Int64)post.likes;
+        value["dislikesCount"] = (Json::Int64)post.dislikes;
+        root.append(std::move(value));
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, root);
+}
+
+std::string encodeCbor(const std::vector<Post> &posts) {
+    CborWriter out;
+    out.array(posts.size());
+    for (const auto &post : posts) {
+        out.map(8);
+        out.text("id");
+        out.text(post.id);
+        out.text("content");
+        out.text(post.content);
+        out.text("author");
+        out.text(post.author);
+        out.text("tags");
+        out.array(post.tags.size());
+        for (const auto &tag : post.tags) {
+            out.text(tag);
+        }
+        out.text("img");
+        out.array(post.images.size());
+        for (const auto &image : post.images) {
+            out.bytes(image.data(), image.size());
+        }
+        out.text("createdAt");
+        out.integer(post.createdAtUs);
+        out.text("likesCount");
+        out.integer(post.likes);
+        out.text("dislikesCount");
+        out.integer(post.dislikes);
+    }
+    return out.release();
+}
+
+// Декодирование, как у клиента: картинки приводятся к байтам.
+size_t decodeJson(const std::string &body) {
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    Json::Value root;
+    std::string errors;
+    reader->parse(body.data(), body.data() + body.size(), &root, &errors);
+    size_t bytes = 0;
+    for (const auto &post : root) {
+        for (const auto &image : post["img"]) {
+            bytes += drogon::utils::base64Decode(image.asString()).size();
+        }
+    }
+    return bytes;
+}
+
+struct CborReader {
+    const uint8_t *p;
+    const uint8_t *end;
+    size_t bytes = 0;
+
+    uint64_t argument(uint8_t info) {
+        if (info < 24) {
+            return info;
+        }
+        int width = 1 << (info - 24);
+        uint64_t value = 0;
+        for (int i = 0; i < width && p < end; ++i) {
+            value = (value << 8) | *p++;
+        }
+        return value;
+    }
+
+    void item() {
+        uint8_t initial = *p++;
+        uint8_t major = initial >> 5;
+        uint64_t value = argument(initial & 0x1f);
+        switch (major) {
+            case 2:
+            case 3: {
+                std::string copy(reinterpret_cast<const char *>(p), value);
+                if (major == 2) {
+                    bytes += copy.size();
+                }
+                p += value;
+                break;
+            }
+            case 4:
+                for (uint64_t i = 0; i < value; ++i) {
+                    item();
+                }
+                break;
+            case 5:
+                for (uint64_t i = 0; i < value * 2; ++i) {
+                    item();
+                }
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+size_t decodeCbor(const std::string &body) {
+    CborReader reader{
+        reinterpret_cast<const uint8_t *>(body.data()),
+        reinterpret_cast<const uint8_t *>(body.data() + body.size())
+    };
+    reader.item();
+    return reader.bytes;
+}
+
+template <typename F>
+double bestOfMs(int runs, F &&f) {
+    double best = 1e18;
+    for (int i = 0; i < runs; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(
+            best, std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start
+                  )
+                      .count()
+        );
+    }
+    return best;
+}
+
+// Прежний разбор created_at ("YYYY-MM-DD HH:MM:SS.ffffff") для CBOR.
+int64_t parseTextTimestampUs(const std::string &text) {
+    auto number = [&](size_t pos, size_t len) {
+        int64_t value = 0;
+        for (size_t i = pos; i < pos + len; ++i) {
+            value = value * 10 + (text[i] - '0');
+        }
+        return value;
+    };
+    int64_t year = number(0, 4), month = number(5, 2), day = number(8, 2);
+    year -= month <= 2;
+    int64_t era = year / 400;
+    int64_t yoe = year - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    return ((days * 24 + number(11, 2)) * 60 + number(14, 2)) * 60 * 1000000 +
+           number(17, 2) * 1000000 + number(20, 6);
+}
+
+// Стоимость created_at на строку ленты в наносекундах. Поле результата
+// приходит текстом в обоих случаях: прежде это была копия строки
+// (as<std::string>()) и разбор даты для CBOR, теперь parseEpochUs и
+// форматирование только для JSON.
+void timestampCost(size_t rows) {
+    std::vector<std::string> text(rows), micros(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        int64_t us = 1792413296123456 + i * 997;
+        text[i] = formatIsoTimestampUs(us);
+        text[i][10] = ' ';
+        text[i].pop_back();
+        micros[i] = std::to_string(us);
+    }
+    const int runs = 20;
+    size_t sink = 0;
+    double textJson = bestOfMs(runs, [&] {
+        for (const auto &value : text) {
+            sink += std::string(value).size();
+        }
+    });
+    double textCbor = bestOfMs(runs, [&] {
+        for (const auto &value : text) {
+            sink += parseTextTimestampUs(std::string(value));
+        }
+    });
+    double microsJson = bestOfMs(runs, [&] {
+        for (const auto &value : micros) {
+            sink += formatIsoTimestampUs(parseEpochUs(value)).size();
+        }
+    });
+    double microsCbor = bestOfMs(runs, [&] {
+        for (const auto &value : micros) {
+            sink += parseEpochUs(value);
+        }
+    });
+    std::printf("\ncreated_at per row, ns (%zu rows)\n", rows);
+    std::printf("%-10s %10s %10s\n", "column", "json", "cbor");
+    std::printf("%-10s %10.1f %10.1f\n", "timestamp", textJson * 1e6 / rows,
+                textCbor * 1e6 / rows);
+    std::printf("%-10s %10.1f %10.1f\n", "epoch_us", microsJson * 1e6 / rows,
+                microsCbor * 1e6 / rows);
+    if (sink == 0) {
+        std::printf("\n");
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20;
+    size_t imageKb = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+    auto posts = makePosts(count, imageKb * 1024);
+    const int runs = 20;
+
+    std::string json, cbor;
+    double jsonEncode = bestOfMs(runs, [&] { json = encodeJson(posts); });
+    double cborEncode = bestOfMs(runs, [&] { cbor = encodeCbor(posts); });
+    size_t jsonImages = 0, cborImages = 0;
+    double jsonDecode = bestOfMs(runs, [&] { jsonImages = decodeJson(json); });
+    double cborDecode = bestOfMs(runs, [&] { cborImages = decodeCbor(cbor); });
+    if (jsonImages != cborImages) {
+        std::fprintf(stderr, "image bytes differ: %zu vs %zu\n", jsonImages,
+                     cborImages);
+        return 1;
+    }
+
+    std::printf("%zu posts, %zu KB image each, best of %d runs\n", count,
+                imageKb, runs);
+    std::printf("%-6s %12s %12s %12s\n", "format", "bytes", "encode ms",
+                "decode ms");
+    std::printf("%-6s %12zu %12.3f %12.3f\n", "json", json.size(), jsonEncode,
+                jsonDecode);
+    std::printf("%-6s %12zu %12.3f %12.3f\n", "cbor", cbor.size(), cborEncode,
+                cborDecode);
+    timestampCost(100000);
+    return 0;
+}
@@ -0,0 +1,206 @@
+// Нагрузка на запущенный сервер по keep-alive соединениям: запросы в
+// секунду и перцентили задержки. Для сравнения режимов сервер запускается
+// с workers.processes = 0 (один процесс, потоки по Topology) и с
+// workers.processes = N, остальные настройки одинаковые.
+//
+//   cmake -DPRIYOMYSH_BUILD_BENCH=ON .. && make http_bench
+//   ./http_bench host port path [connections] [seconds] [header...]
+//   ./http_bench 127.0.0.1 8080 /api/posts/feed/alice 256 30 "X-Debug-Token: $T"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "codec/Ascii.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+    std::vector<uint32_t> latenciesUs;
+    uint64_t errors = 0;
+    uint64_t reconnects = 0;
+};
+
+int connectTo(const addrinfo *addr) {
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Читает один ответ с Content-Length. false — соединение нужно открыть
+// заново (закрыто сервером, ошибка или ответ без длины).
+bool readResponse(int fd, std::string &buffer, bool &ok) {
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    ok = buffer.compare(9, 1, "2") == 0;
+    std::string headers = buffer.substr(0, headerEnd);
+    asciiToLower(headers);
+    auto pos = headers.find("content-length:");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    size_t total = headerEnd + 4 + std::strtoull(
+        headers.c_str() + pos + 15, nullptr, 10
+    );
+    while (buffer.size() < total) {
+        char chunk[16384];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    buffer.erase(0, total);
+    return headers.find("connection: close") == std::string::npos;
+}
+
+void runConnection(
+    const addrinfo *addr,
+    const std::string &request,
+    Clock::time_point deadline,
+    Result &result
+) {
+    int fd = -1;
+    std::string buffer;
+    while (Clock::now() < deadline) {
+        if (fd < 0) {
+            fd = connectTo(addr);
+            if (fd < 0) {
+                ++result.errors;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            buffer.clear();
+            ++result.reconnects;
+        }
+        auto start = Clock::now();
+        bool ok = false;
+        bool keep = send(fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+                        (ssize_t)request.size() &&
+                    readResponse(fd, buffer, ok);
+        if (ok) {
+            result.latenciesUs.push_back(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - start
+                )
+                    .count()
+            );
+        } else {
+            ++result.errors;
+        }
+        if (!keep) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::fprintf(stderr,
+                     "usage: %s host port path [connections] [seconds] "
+                     "[header...]\n",
+                     argv[0]);
+        return 2;
+    }
+    std::string host = argv[1];
+    size_t connections = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 64;
+    int seconds = argc > 5 ? std::atoi(argv[5]) : 10;
+    std::string request = "GET " + std::string(argv[3]) + " HTTP/1.1\r\nHost: " +
+                          host + "\r\n";
+    for (int i = 6; i < argc; ++i) {
+        request += std::string(argv[i]) + "\r\n";
+    }
+    request += "\r\n";
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addr = nullptr;
+    if (getaddrinfo(host.c_str(), argv[2], &hints, &addr) != 0) {
+        std::fprintf(stderr, "cannot resolve %s\n", host.c_str());
+        return 1;
+    }
+
+    // Соединение на поток: клиент не должен стать узким местом раньше
+    // сервера, а замкнутый цикл держит ровно connections запросов в полете.
+    std::vector<Result> results(connections);
+    std::vector<std::thread> threads;
+    auto started = Clock::now();
+    auto deadline = started + std::chrono::seconds(seconds);
+    for (size_t i = 0; i < connections; ++i) {
+        threads.emplace_back(
+            runConnection, addr, std::cref(request), deadline,
+            std::ref(results[i])
+        );
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - started).count();
+    freeaddrinfo(addr);
+
+    std::vector<uint32_t> latencies;
+    uint64_t errors = 0, reconnects = 0;
+    for (auto &result : results) {
+        latencies.insert(
+            latencies.end(), result.latenciesUs.begin(),
+            result.latenciesUs.end()
+        );
+        errors += result.errors;
+        reconnects += result.reconnects;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) -> double {
+        if (latencies.empty()) {
+            return 0;
+        }
+        return latencies[std::min(
+                   latencies.size() - 1, (size_t)(p * latencies.size())
+               )] /
+               1000.0;
+    };
+
+    std::printf("%zu connections, %.1f s\n", connections, elapsed);
+    std::printf("%-12s %12.0f\n", "req/s", latencies.size() / elapsed);
+    std::printf("%-12s %12.2f\n", "p50 ms", percentile(0.50));
+    std::printf("%-12s %12.2f\n", "p99 ms", percentile(0.99));
+    std::printf("%-12s %12.2f\n", "p99.9 ms", percentile(0.999));
+    std::printf("%-12s %12llu\n", "errors", (unsigned long long)errors);
+    std::printf("%-12s %12llu\n", "connects", (unsigned long long)reconnects);
+    return 0;
+}
@@ -0,0 +1,139 @@
+// UUIDv4 против UUIDv7 для posts.id_uuid: скорость генерации в процессе и,
+// если заданы переменные POSTGRES_*, скорость вставки и размер
+// B-дерева первичного ключа. Таблицы создаются и удаляются самим
+// бенчмарком.
+//
+//   cmake -DPRIYOMYSH_BUILD_BENCH=ON .. && make uuid_bench
+//   ./uuid_bench [rows] [batch]
+#include <drogon/orm/DbClient.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "db/UuidV7.h"
+
+namespace {
+
+// Прежний генератор постов: UUIDv4 с меткой шарда в последних байтах.
+std::string newUuidV4(uint16_t tail) {
+    thread_local std::mt19937_64 gen(std::random_device{}());
+    uint64_t hi = gen();
+    uint64_t lo = gen();
+    hi = (hi & 0xffffffffffff0fffull) | 0x0000000000004000ull;
+    lo = (lo & 0x3fffffffffff0000ull) | 0x8000000000000000ull | tail;
+    char buf[37];
+    std::snprintf(
+        buf, sizeof(buf), "%08x-%04x-%04x-%04x-%012llx",
+        static_cast<unsigned>(hi >> 32),
+        static_cast<unsigned>((hi >> 16) & 0xffff),
+        static_cast<unsigned>(hi & 0xffff), static_cast<unsigned>(lo >> 48),
+        static_cast<unsigned long long>(lo & 0xffffffffffffull)
+    );
+    return buf;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start
+    )
+        .count();
+}
+
+template <typename F>
+double generateNsPerId(size_t count, F &&generate) {
+    volatile char sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        sink = generate(0xfd00)[35];
+    }
+    (void)sink;
+    return elapsedMs(start) * 1e6 / count;
+}
+
+std::string connectionString() {
+    auto env = [](const char *name) {
+        auto value = std::getenv(name);
+        return std::string(value ? value : "");
+    };
+    return "host=" + env("POSTGRES_HOST") + " port=" + env("POSTGRES_PORT") +
+           " dbname=" + env("POSTGRES_DATABASE") +
+           " user=" + env("POSTGRES_USERNAME") +
+           " password=" + env("POSTGRES_PASSWORD");
+}
+
+struct InsertResult {
+    double rowsPerSec;
+    long long indexBytes;
+};
+
+// Вставка пачками через unnest, как в ReactionBuffer, в таблицу с uuid
+// первичным ключом.
+template <typename F>
+InsertResult insertRows(
+    const drogon::orm::DbClientPtr &db,
+    const std::string &table,
+    size_t rows,
+    size_t batch,
+    F &&generate
+) {
+    db->execSqlSync("DROP TABLE IF EXISTS " + table);
+    db->execSqlSync(
+        "CREATE TABLE " + table +
+        " (id_uuid UUID PRIMARY KEY, content VARCHAR(1000) NOT NULL)"
+    );
+    auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < rows; done += batch) {
+        std::string ids = "{";
+        size_t n = std::min(batch, rows - done);
+        for (size_t i = 0; i < n; ++i) {
+            ids += generate(0xfd00);
+            ids += i + 1 < n ? ',' : '}';
+        }
+        db->execSqlSync(
+            "INSERT INTO " + table +
+                " (id_uuid, content) SELECT id, 'bench post' FROM "
+                "unnest($1::uuid[]) AS id",
+            ids
+        );
+    }
+    double ms = elapsedMs(start);
+    auto r = db->execSqlSync(
+        "SELECT pg_relation_size('" + table + "_pkey') AS bytes"
+    );
+    long long bytes = r[0]["bytes"].as<long long>();
+    db->execSqlSync("DROP TABLE " + table);
+    return {rows * 1000.0 / ms, bytes};
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t rows = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t batch = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+    if (rows == 0 || batch == 0) {
+        std::fprintf(stderr, "usage: %s [rows] [batch]\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("generation, ns per id\n");
+    std::printf("  v4 %8.1f\n", generateNsPerId(rows, newUuidV4));
+    std::printf("  v7 %8.1f\n", generateNsPerId(rows, newUuidV7));
+
+    if (!std::getenv("POSTGRES_HOST")) {
+        std::printf("POSTGRES_HOST is not set, skipping insert benchmark\n");
+        return 0;
+    }
+    auto db = drogon::orm::DbClient::newPgClient(connectionString(), 1);
+    auto v4 = insertRows(db, "uuid_bench_v4", rows, batch, newUuidV4);
+    auto v7 = insertRows(db, "uuid_bench_v7", rows, batch, newUuidV7);
+
+    std::printf("%zu rows, batch %zu\n", rows, batch);
+    std::printf("%-4s %12s %14s\n", "key", "rows/sec", "pkey bytes");
+    std::printf("%-4s %12.0f %14lld\n", "v4", v4.rowsPerSec, v4.indexBytes);
+    std::printf("%-4s %12.0f %14lld\n", "v7", v7.rowsPerSec, v7.indexBytes);
+    return 0;
+}
\ No newline at end of file
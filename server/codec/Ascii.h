@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+// Нижний регистр только для латиницы A-Z: без локали и без UB ::tolower на
+// отрицательном char, байты >= 0x80 остаются как есть. Нужен для uuid и
+// заголовков HTTP, которые сравниваются побайтно.
+inline void asciiToLower(std::string &text) {
+    for (char &c : text) {
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+}
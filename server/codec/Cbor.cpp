@@ -0,0 +1,61 @@
+#include "Cbor.h"
+
+void CborWriter::head(uint8_t major, uint64_t value) {
+    major <<= 5;
+    if (value < 24) {
+        out_ += static_cast<char>(major | value);
+        return;
+    }
+    int width;
+    if (value <= 0xff) {
+        out_ += static_cast<char>(major | 24);
+        width = 1;
+    } else if (value <= 0xffff) {
+        out_ += static_cast<char>(major | 25);
+        width = 2;
+    } else if (value <= 0xffffffff) {
+        out_ += static_cast<char>(major | 26);
+        width = 4;
+    } else {
+        out_ += static_cast<char>(major | 27);
+        width = 8;
+    }
+    for (int i = width - 1; i >= 0; --i) {
+        out_ += static_cast<char>((value >> (i * 8)) & 0xff);
+    }
+}
+
+void CborWriter::null() {
+    out_ += static_cast<char>(0xf6);
+}
+
+void CborWriter::boolean(bool value) {
+    out_ += static_cast<char>(value ? 0xf5 : 0xf4);
+}
+
+void CborWriter::integer(int64_t value) {
+    if (value >= 0) {
+        head(0, static_cast<uint64_t>(value));
+    } else {
+        // Отрицательное n кодируется как -1 - n.
+        head(1, static_cast<uint64_t>(-1 - value));
+    }
+}
+
+void CborWriter::text(std::string_view value) {
+    head(3, value.size());
+    out_.append(value.data(), value.size());
+}
+
+void CborWriter::bytes(const void *data, size_t size) {
+    head(2, size);
+    out_.append(static_cast<const char *>(data), size);
+}
+
+void CborWriter::array(uint64_t size) {
+    head(4, size);
+}
+
+void CborWriter::map(uint64_t size) {
+    head(5, size);
+}
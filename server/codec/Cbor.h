@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Минимальный кодировщик CBOR (RFC 8949) для бинарных ответов API: байтовые
+// строки вместо base64 и целые числа вместо текстовых дат. Длины массивов
+// и объектов задаются заранее, неопределенная длина не используется.
+class CborWriter {
+public:
+    explicit CborWriter(size_t reserve = 0) {
+        out_.reserve(reserve);
+    }
+
+    void null();
+    void boolean(bool value);
+    void integer(int64_t value);
+    void text(std::string_view value);
+    void bytes(const void *data, size_t size);
+    void array(uint64_t size);
+    void map(uint64_t size);
+
+    std::string release() {
+        return std::move(out_);
+    }
+
+private:
+    void head(uint8_t major, uint64_t value);
+
+    std::string out_;
+};
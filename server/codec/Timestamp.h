@@ -0,0 +1,58 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Время в микросекундах от эпохи в ISO-8601 UTC
+// ("YYYY-MM-DDTHH:MM:SS.ffffffZ"). Вызывается только при сериализации
+// ответа: из базы время приходит целым числом, а не строкой.
+inline std::string formatIsoTimestampUs(int64_t us) {
+    int64_t secs = us / 1000000 - (us % 1000000 < 0);
+    int64_t micros = us - secs * 1000000;
+    int64_t days = secs / 86400 - (secs % 86400 < 0);
+    int64_t daySecs = secs - days * 86400;
+
+    // civil_from_days (Howard Hinnant).
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t day = doy - (153 * mp + 2) / 5 + 1;
+    int64_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = yoe + era * 400 + (month <= 2);
+
+    static constexpr char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "6869707172737475767778798081828384858687888990919293949596979899";
+    char out[] = "0000-00-00T00:00:00.000000Z";
+    auto two = [&](size_t pos, uint32_t value) {
+        out[pos] = pairs[value * 2];
+        out[pos + 1] = pairs[value * 2 + 1];
+    };
+    auto daySeconds = static_cast<uint32_t>(daySecs);
+    auto microseconds = static_cast<uint32_t>(micros);
+    two(0, static_cast<uint32_t>(year / 100));
+    two(2, static_cast<uint32_t>(year % 100));
+    two(5, static_cast<uint32_t>(month));
+    two(8, static_cast<uint32_t>(day));
+    two(11, daySeconds / 3600);
+    two(14, daySeconds / 60 % 60);
+    two(17, daySeconds % 60);
+    two(20, microseconds / 10000);
+    two(22, microseconds / 100 % 100);
+    two(24, microseconds % 100);
+    return std::string(out, sizeof(out) - 1);
+}
+
+// Разбор epoch_us(...) из текстового результата. Драйвер отдает поля
+// текстом, а as<int64_t>() идет через std::stoll с учетом локали, что в
+// несколько раз дороже from_chars.
+inline int64_t parseEpochUs(std::string_view text) {
+    int64_t value = 0;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
+}
@@ -1,6 +1,7 @@
 #include "AuthController.h"
 #include <drogon/utils/Utilities.h>
 #include "helpers.h"
+#include "services/AvailabilityFilter.h"
 
 using namespace drogon;
 
@@ -12,21 +13,23 @@ void AuthController::ping(const HttpRequestPtr &req, Callback &&callback) {
     callback(resp);
 }
 
-void AuthController::registerUser(
-    const HttpRequestPtr &req,
-    Callback &&callback
-) {
+static HttpResponsePtr
+errorResponse(const std::string &reason, HttpStatusCode code) {
+    Json::Value ret;
+    ret["reason"] = reason;
+    auto resp = HttpResponse::newHttpJsonResponse(std::move(ret));
+    resp->setStatusCode(code);
+    return resp;
+}
+
+Task<HttpResponsePtr> AuthController::registerUser(HttpRequestPtr req) {
     auto json = req->getJsonObject();
     if (!json) {
-        LOG_INFO << "json in AuthController::registerUser does not exist";
-        Json::Value ret;
-        ret["reason"] = "Wrong profile data";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        AsyncLog::instance().event(
+            "auth", "register rejected", {{"reason", "no_json"}}
+        );
+        co_return errorResponse("Wrong profile data", k400BadRequest);
     }
-    LOG_INFO << "json in AuthController::registerUser exists";
 
     auto login = (*json)["login"].asString();
     auto email = (*json)["email"].asString();
@@ -35,202 +38,255 @@ void AuthController::registerUser(
     auto phone = (*json)["phone"].asString();
     auto image = json->get("image", "").asString();
 
-    LOG_INFO << "got all values from json in AuthController::registerUser";
-
     if (!validateLogin(login)) {
-        Json::Value ret;
-        ret["reason"] = "Incorrect login format";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        co_return errorResponse("Incorrect login format", k400BadRequest);
     }
 
     if (!validateEmail(email)) {
-        Json::Value ret;
-        ret["reason"] = "Incorrect email format";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        co_return errorResponse("Incorrect email format", k400BadRequest);
     }
 
     if (!validatePasswordStrength(password)) {
-        Json::Value ret;
-        ret["reason"] = "Weak password";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        co_return errorResponse("Weak password", k400BadRequest);
     }
 
     if (!validatePhone(phone)) {
-        Json::Value ret;
-        ret["reason"] = "Incorrect phone format";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        co_return errorResponse("Incorrect phone format", k400BadRequest);
     }
 
     if (!validateImage(image)) {
-        Json::Value ret;
-        ret["reason"] = "Incorrect image format";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        co_return errorResponse("Incorrect image format", k400BadRequest);
     }
 
-    auto db = getDbClient();
+    auto db = getDbClient(login);
     if (!db) {
         LOG_ERROR << "db client is null in AuthController::registerUser";
-        return;
+        co_return errorResponse("Internal error", k500InternalServerError);
     }
 
-    db->execSqlAsync(
-        R"sql(SELECT login, email, phone FROM users WHERE login=$1 OR email=$2 OR phone=$3)sql",
-        [callback, db, login, email, password, isPublic, phone,
-         image](const drogon::orm::Result &r) {
-            if (!r.empty()) {
-                Json::Value ret;
-                ret["reason"] =
-                    "User with this login, email or phone already exists";
-                auto resp = HttpResponse::newHttpJsonResponse(ret);
-                resp->setStatusCode(k409Conflict);
-                callback(resp);
-                return;
+    // Вставка и определение поля, по которому случился конфликт, — один
+    // запрос. Подзапросы к users видят снимок до вставки, поэтому при
+    // гонке с параллельной регистрацией поле может остаться неизвестным.
+    static const std::string insertSql = R"sql(
+        WITH inserted AS (
+            INSERT INTO users (login, email, password, is_public, phone, image)
+            VALUES ($1, $2, $3, $4, $5, $6)
+            ON CONFLICT DO NOTHING
+            RETURNING login
+        )
+        SELECT EXISTS (SELECT 1 FROM inserted) AS inserted,
+               EXISTS (SELECT 1 FROM users WHERE login = $1) AS login_taken,
+               EXISTS (SELECT 1 FROM users WHERE email = $2) AS email_taken,
+               EXISTS (SELECT 1 FROM users WHERE phone = $5) AS phone_taken
+    )sql";
+    static const std::string conflictSql = R"sql(
+        SELECT login = $1 AS login_taken, email = $2 AS email_taken,
+               phone = $3 AS phone_taken
+        FROM users WHERE login = $1 OR email = $2 OR phone = $3
+        LIMIT 1
+    )sql";
+
+    auto conflict = [](const drogon::orm::Row &row) {
+        std::string field = row["login_taken"].as<bool>()   ? "login"
+                            : row["email_taken"].as<bool>() ? "email"
+                            : row["phone_taken"].as<bool>() ? "phone"
+                                                            : "unknown";
+        Json::Value ret;
+        ret["reason"] = "User with this login, email or phone already exists";
+        ret["field"] = field;
+        auto resp = HttpResponse::newHttpJsonResponse(std::move(ret));
+        resp->setStatusCode(k409Conflict);
+        return resp;
+    };
+
+    try {
+        // email и phone уникальны только в пределах шарда, поэтому на
+        // остальных шардах они проверяются отдельно.
+        auto &router = ShardRouter::instance();
+        if (router.count() > 1) {
+            std::vector<TimedDbClientPtr> others;
+            size_t home = router.shardOf(login);
+            for (size_t i = 0; i < router.count(); ++i) {
+                if (i != home) {
+                    others.push_back(router.shard(i).primary);
+                }
+            }
+            auto results =
+                co_await scatterSql(others, conflictSql, login, email, phone);
+            for (const auto &r : results) {
+                if (!r.empty()) {
+                    co_return conflict(r[0]);
+                }
             }
+        }
 
-            std::string hashed = hashPassword(password);
-
-            db->execSqlAsync(
-                R"sql(INSERT INTO users (login, email, password, is_public, phone, image) VALUES ($1, $2, $3, $4, $5, $6) RETURNING *)sql",
-                [callback, login, email, isPublic, phone,
-                 image](const drogon::orm::Result &r) {
-                    Json::Value profile;
-                    profile["login"] = login;
-                    profile["email"] = email;
-                    profile["isPublic"] = isPublic;
-                    if (!phone.empty()) {
-                        profile["phone"] = phone;
-                    }
-                    if (!image.empty()) {
-                        profile["image"] = image;
-                    }
-
-                    Json::Value ret;
-                    ret["profile"] = profile;
-                    auto resp = HttpResponse::newHttpJsonResponse(ret);
-                    resp->setStatusCode(k201Created);
-                    callback(resp);
-                },
-                [callback](const drogon::orm::DrogonDbException &e) {
-                    LOG_ERROR << e.base().what();
-                    Json::Value ret;
-                    ret["reason"] = "Wrong profile data";
-                    auto resp = HttpResponse::newHttpJsonResponse(ret);
-                    resp->setStatusCode(k400BadRequest);
-                    callback(resp);
-                },
-                login, email, hashed, isPublic, phone, image
-            );
-        },
-        [callback](const drogon::orm::DrogonDbException &e) {
-            LOG_ERROR << e.base().what();
-            Json::Value ret;
-            ret["reason"] = "Wrong profile data";
-            auto resp = HttpResponse::newHttpJsonResponse(ret);
-            resp->setStatusCode(k400BadRequest);
-            callback(resp);
-        },
-        login, email, phone
-    );
+        std::string hashed =
+            co_await runOnCpuPool([&]() { return hashPassword(password); });
+
+        auto r = co_await db->execSqlCoro(
+            insertSql, login, email, std::move(hashed), isPublic, phone, image
+        );
+        if (!r[0]["inserted"].as<bool>()) {
+            co_return conflict(r[0]);
+        }
+        auto &filter = AvailabilityFilter::instance();
+        filter.add(AvailabilityFilter::Login, login);
+        filter.add(AvailabilityFilter::Email, email);
+        filter.add(AvailabilityFilter::Phone, phone);
+    } catch (const drogon::orm::DrogonDbException &e) {
+        LOG_ERROR << e.base().what();
+        co_return errorResponse("Wrong profile data", k400BadRequest);
+    }
+
+    Json::Value profile;
+    profile["login"] = std::move(login);
+    profile["email"] = std::move(email);
+    profile["isPublic"] = isPublic;
+    if (!phone.empty()) {
+        profile["phone"] = std::move(phone);
+    }
+    if (!image.empty()) {
+        profile["image"] = std::move(image);
+    }
+
+    Json::Value ret;
+    ret["profile"] = std::move(profile);
+    auto resp = HttpResponse::newHttpJsonResponse(std::move(ret));
+    resp->setStatusCode(k201Created);
+    co_return resp;
+}
+
+// Проверка занятости при вводе формы регистрации: в ответе для каждого
+// переданного поля true, если значение свободно. Окончательно уникальность
+// проверяет registerUser.
+Task<HttpResponsePtr> AuthController::available(HttpRequestPtr req) {
+    struct Check {
+        AvailabilityFilter::Field field;
+        const char *name;
+        bool (*validate)(const std::string &);
+        const char *formatError;
+        std::string sql;
+    };
+    static const Check checks[] = {
+        {AvailabilityFilter::Login, "login", validateLogin,
+         "Incorrect login format",
+         R"sql(SELECT 1 FROM users WHERE login = $1 LIMIT 1)sql"},
+        {AvailabilityFilter::Email, "email", validateEmail,
+         "Incorrect email format",
+         R"sql(SELECT 1 FROM users WHERE email = $1 LIMIT 1)sql"},
+        {AvailabilityFilter::Phone, "phone", validatePhone,
+         "Incorrect phone format",
+         R"sql(SELECT 1 FROM users WHERE phone = $1 LIMIT 1)sql"},
+    };
+
+    Json::Value ret(Json::objectValue);
+    auto &filter = AvailabilityFilter::instance();
+    try {
+        for (const auto &check : checks) {
+            auto value = req->getParameter(check.name);
+            if (value.empty()) {
+                continue;
+            }
+            if (!check.validate(value)) {
+                co_return errorResponse(check.formatError, k400BadRequest);
+            }
+            bool filtered = filter.ready();
+            if (filtered && !filter.mightBeTaken(check.field, value)) {
+                ret[check.name] = true;
+                continue;
+            }
+            // Логин живет на своем шарде, email и телефон ищутся на всех.
+            bool taken = false;
+            if (check.field == AvailabilityFilter::Login) {
+                auto r = co_await getReadDbClient(value, value)
+                             ->execSqlCoro(check.sql, value);
+                taken = !r.empty();
+            } else {
+                auto results = co_await scatterSql(
+                    ShardRouter::instance().readers(""), check.sql, value
+                );
+                for (const auto &r : results) {
+                    taken = taken || !r.empty();
+                }
+            }
+            if (filtered) {
+                filter.recordDbCheck(taken);
+            }
+            ret[check.name] = !taken;
+        }
+    } catch (const drogon::orm::DrogonDbException &e) {
+        LOG_ERROR << e.base().what();
+        co_return errorResponse("Internal error", k500InternalServerError);
+    }
+    if (ret.empty()) {
+        co_return errorResponse(
+            "login, email or phone is required", k400BadRequest
+        );
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(std::move(ret));
+    resp->setStatusCode(k200OK);
+    co_return resp;
 }
 
-void AuthController::signIn(const HttpRequestPtr &req, Callback &&callback) {
+Task<HttpResponsePtr> AuthController::signIn(HttpRequestPtr req) {
     auto json = req->getJsonObject();
 
     if (!json) {
-        LOG_INFO << "json in AuthController::signIn does not exist";
-        Json::Value ret;
-        ret["reason"] = "Wrong profile data";
-        auto resp = HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k400BadRequest);
-        callback(resp);
-        return;
+        AsyncLog::instance().event(
+            "auth", "sign in rejected", {{"reason", "no_json"}}
+        );
+        co_return errorResponse("Wrong profile data", k400BadRequest);
     }
-    LOG_INFO << "json in AuthController::signIn exists";
 
     auto login = (*json)["login"].asString();
     auto password = (*json)["password"].asString();
 
-    auto db = getDbClient();
+    auto db = getDbClient(login);
     if (!db) {
-        LOG_ERROR << "db client is null in AuthController::registerUser";
-        return;
+        LOG_ERROR << "db client is null in AuthController::signIn";
+        co_return errorResponse("Internal error", k500InternalServerError);
     }
 
-    db->execSqlAsync(
-        R"sql(SELECT password, token_number, update_token FROM users WHERE login = $1)sql",
-        [callback, login, password](const drogon::orm::Result &r) {
-            if (r.empty()) {
-                Json::Value ret;
-                ret["reason"] =
-                    "User with this login and password was not found";
-                auto resp = HttpResponse::newHttpJsonResponse(ret);
-                resp->setStatusCode(k401Unauthorized);
-                callback(resp);
-                return;
-            }
-            auto row = r[0];
-            std::string hashed = row["password"].as<std::string>();
-            if (!checkPassword(password, hashed)) {
-                Json::Value ret;
-                ret["reason"] =
-                    "User with this login and password was not found";
-                auto resp = HttpResponse::newHttpJsonResponse(ret);
-                resp->setStatusCode(k401Unauthorized);
-                callback(resp);
-                return;
-            }
+    // Вход — один запрос: пароль проверяется в базе через pgcrypto, и
+    // update_token увеличивается только при совпадении, неверный пароль
+    // строку не меняет. crypt() из pgcrypto знает префикс $2a$, а не $2b$
+    // из crypt_gensalt_r; в реализации Openwall, которую использует
+    // pgcrypto, они дают один и тот же хеш.
+    static const std::string signInSql = R"sql(
+        WITH checked AS (
+            SELECT login FROM users
+            WHERE login = $1
+              AND crypt($2, '$2a$' || substr(password, 5)) =
+                  '$2a$' || substr(password, 5)
+        )
+        UPDATE users u SET update_token = u.update_token + 1
+        FROM checked c
+        WHERE u.login = c.login
+        RETURNING u.token_number, u.update_token
+    )sql";
 
-            int token_number = row["token_number"].as<int>();
-            int update_token = row["update_token"].as<int>();
-
-            auto db = getDbClient();
-            db->execSqlAsync(
-                R"sql(UPDATE users SET update_token = update_token + 1 WHERE login = $1 RETURNING update_token)sql",
-                [callback, login, token_number](const drogon::orm::Result &r) {
-                    int new_update_token = r[0]["update_token"].as<int>();
-                    std::string jwt =
-                        createToken(login, token_number, new_update_token);
-                    Json::Value ret;
-                    ret["token"] = jwt;
-                    auto resp = HttpResponse::newHttpJsonResponse(ret);
-                    resp->setStatusCode(k200OK);
-                    callback(resp);
-                },
-                [callback](const drogon::orm::DrogonDbException &e) {
-                    LOG_ERROR << e.base().what();
-                    Json::Value ret;
-                    ret["reason"] =
-                        "User with this login and password was not found";
-                    auto resp = HttpResponse::newHttpJsonResponse(ret);
-                    resp->setStatusCode(k401Unauthorized);
-                    callback(resp);
-                },
-                login
+    try {
+        auto r = co_await db->execSqlCoro(signInSql, login, password);
+        if (r.empty()) {
+            co_return errorResponse(
+                "User with this login and password was not found",
+                k401Unauthorized
             );
-        },
-        [callback](const drogon::orm::DrogonDbException &e) {
-            LOG_ERROR << e.base().what();
-            Json::Value ret;
-            ret["reason"] = "User with this login and password was not found";
-            auto resp = HttpResponse::newHttpJsonResponse(ret);
-            resp->setStatusCode(k401Unauthorized);
-            callback(resp);
-        },
-        login
-    );
+        }
+        int token_number = r[0]["token_number"].as<int>();
+        int new_update_token = r[0]["update_token"].as<int>();
+        TokenCache::instance().put(login, token_number);
+
+        Json::Value ret;
+        ret["token"] = createToken(login, token_number, new_update_token);
+        auto resp = HttpResponse::newHttpJsonResponse(std::move(ret));
+        resp->setStatusCode(k200OK);
+        co_return resp;
+    } catch (const drogon::orm::DrogonDbException &e) {
+        LOG_ERROR << e.base().what();
+        co_return errorResponse(
+            "User with this login and password was not found", k401Unauthorized
+        );
+    }
 }
\ No newline at end of file
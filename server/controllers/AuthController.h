@@ -1,6 +1,7 @@
 #pragma once
 
 #include <drogon/HttpController.h>
+#include <drogon/utils/coroutine.h>
 
 class AuthController : public drogon::HttpController<AuthController> {
 public:
@@ -8,12 +9,12 @@ public:
         ADD_METHOD_TO(AuthController::ping, "/api/ping", drogon::Get);
         ADD_METHOD_TO(AuthController::registerUser, "/api/auth/register", drogon::Post);
         ADD_METHOD_TO(AuthController::signIn, "/api/auth/sign-in", drogon::Post);
+        ADD_METHOD_TO(AuthController::available, "/api/auth/available", drogon::Get);
     METHOD_LIST_END
 
     void ping(const drogon::HttpRequestPtr& req,
             std::function<void(const drogon::HttpResponsePtr&)>&& callback);
-    void registerUser(const drogon::HttpRequestPtr& req,
-            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
-    void signIn(const drogon::HttpRequestPtr& req,
-            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    drogon::Task<drogon::HttpResponsePtr> registerUser(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> signIn(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> available(drogon::HttpRequestPtr req);
 };
\ No newline at end of file
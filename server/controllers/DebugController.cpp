@@ -0,0 +1,509 @@
+#include "DebugController.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "db/QueryLog.h"
+#include "db/ShardRouter.h"
+#include "db/SingleFlight.h"
+#include "helpers.h"
+#include "services/AdmissionControl.h"
+#include "services/AsyncLog.h"
+#include "services/AvailabilityFilter.h"
+#include "services/FeedHub.h"
+#include "services/IdempotencyStore.h"
+#include "services/MediaStore.h"
+#include "services/PostCache.h"
+#include "services/PostTransfer.h"
+#include "services/Profiler.h"
+#include "services/RequestArena.h"
+#include "services/Supervisor.h"
+#include "services/TokenCache.h"
+#include "services/Topology.h"
+#include "services/Warmup.h"
+
+using namespace drogon;
+
+static void sendDebugError(
+    const Callback &callback,
+    const std::string &reason,
+    HttpStatusCode code
+) {
+    Json::Value ret;
+    ret["reason"] = reason;
+    auto resp = HttpResponse::newHttpJsonResponse(ret);
+    resp->setStatusCode(code);
+    callback(resp);
+}
+
+// Каждая выгрузка держит свой поток и соединения libpq к шардам, поэтому
+// одновременно их идет не больше kMaxExports. Слот освобождается, когда
+// поток выгрузки завершился или ответ так и не начал отправляться.
+constexpr int kMaxExports = 2;
+static std::atomic<int> activeExports{0};
+
+struct ExportSlot {
+    ~ExportSlot() {
+        activeExports.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// Выгрузка читает libpq блокирующими вызовами, поэтому идет в своем
+// потоке, а не в IO-потоке Drogon. Поток ждет, пока в сокете клиента
+// останется не больше kExportMaxInFlight неотправленных байт: медленный
+// клиент тормозит COPY, а не копит выгрузку в памяти.
+constexpr size_t kExportMaxInFlight = 1 << 20;
+
+static void pumpExport(
+    std::shared_ptr<PostTransfer::Export> transfer,
+    ResponseStreamPtr stream,
+    std::weak_ptr<trantor::TcpConnection> connection,
+    std::shared_ptr<ExportSlot> /* slot занят до выхода из потока */
+) {
+    auto conn = connection.lock();
+    if (!conn) {
+        return;
+    }
+    size_t queued = conn->bytesSent();
+    conn.reset();
+    std::string chunk(64 * 1024, '\0');
+    for (;;) {
+        size_t size = transfer->read(chunk.data(), chunk.size());
+        if (size == 0) {
+            break;
+        }
+        if (!stream->send(chunk.substr(0, size))) {
+            return;
+        }
+        queued += size;
+        for (;;) {
+            conn = connection.lock();
+            if (!conn || !conn->connected()) {
+                return;
+            }
+            // В bytesSent входят и заголовки чанков, поэтому он может
+            // обогнать queued.
+            size_t sent = conn->bytesSent();
+            bool drained = sent >= queued || queued - sent <= kExportMaxInFlight;
+            conn.reset();
+            if (drained) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    stream->close();
+}
+
+static void sendProfile(const Callback &callback, std::string profile) {
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setContentTypeCode(CT_APPLICATION_OCTET_STREAM);
+    resp->setBody(std::move(profile));
+    callback(resp);
+}
+
+static void sendDebugForbidden(const Callback &callback) {
+    Json::Value ret;
+    ret["reason"] = "Debug access denied";
+    auto resp = HttpResponse::newHttpJsonResponse(ret);
+    resp->setStatusCode(k403Forbidden);
+    callback(resp);
+}
+
+void DebugController::topQueries(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    size_t limit = 20;
+    auto limitParam = req->getParameter("limit");
+    if (!limitParam.empty()) {
+        try {
+            limit = std::stoul(limitParam);
+        } catch (const std::exception &) {
+            Json::Value ret;
+            ret["reason"] = "limit is incorrect";
+            auto resp = HttpResponse::newHttpJsonResponse(ret);
+            resp->setStatusCode(k400BadRequest);
+            callback(resp);
+            return;
+        }
+    }
+
+    Json::Value queries(Json::arrayValue);
+    for (const auto &stat : QueryLog::instance().top(limit)) {
+        Json::Value q;
+        q["sql"] = stat.sql;
+        q["calls"] = (Json::UInt64)stat.calls;
+        q["errors"] = (Json::UInt64)stat.errors;
+        q["slowCalls"] = (Json::UInt64)stat.slowCalls;
+        q["totalMs"] = stat.totalMs;
+        q["meanMs"] = stat.calls ? stat.totalMs / stat.calls : 0.0;
+        q["maxMs"] = stat.maxMs;
+        queries.append(q);
+    }
+
+    Json::Value ret;
+    ret["queries"] = queries;
+    auto resp = HttpResponse::newHttpJsonResponse(ret);
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::liveStats(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto stats = FeedHub::instance().stats();
+    Json::Value ret;
+    ret["subscribers"] = (Json::UInt64)stats.subscribers;
+    ret["published"] = (Json::UInt64)stats.published;
+    ret["droppedEvents"] = (Json::UInt64)stats.droppedEvents;
+    ret["droppedConnections"] = (Json::UInt64)stats.droppedConnections;
+    auto resp = HttpResponse::newHttpJsonResponse(ret);
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::replicas(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    Json::Value shards(Json::arrayValue);
+    auto &router = ShardRouter::instance();
+    for (size_t i = 0; i < router.count(); ++i) {
+        Json::Value shard;
+        shard["shard"] = (Json::UInt64)i;
+        shard["replicas"] = router.shard(i).replicas->status();
+        shards.append(std::move(shard));
+    }
+    Json::Value ret;
+    ret["shards"] = std::move(shards);
+    auto resp = HttpResponse::newHttpJsonResponse(ret);
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::mediaStats(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp =
+        HttpResponse::newHttpJsonResponse(MediaStore::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::admission(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp =
+        HttpResponse::newHttpJsonResponse(AdmissionControl::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::topology(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(Topology::instance().describe());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::logging(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(AsyncLog::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::allocations(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(RequestArena::stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::postCache(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(PostCache::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::warmup(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto ret = Warmup::instance().stats();
+    ret["tokenCache"] = TokenCache::instance().stats();
+    auto resp = HttpResponse::newHttpJsonResponse(std::move(ret));
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::availability(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(
+        AvailabilityFilter::instance().stats()
+    );
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::idempotency(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(
+        IdempotencyStore::instance().stats()
+    );
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+// NDJSON всех постов или постов ?author=login, ответ chunked. COPY читает
+// отдельный поток pumpExport и сам отдает куски в поток ответа, IO-поток
+// Drogon не блокируется. Медленный клиент не копит выгрузку в памяти:
+// pumpExport раз в 10 мс сверяет bytesSent() соединения и ждет, пока
+// неотправленным останется не больше kExportMaxInFlight. Для больших
+// выгрузок есть CLI-режим drogon_app export.
+void DebugController::exportPosts(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto author = req->getParameter("author");
+    if (!author.empty() && !validateLogin(author)) {
+        Json::Value ret;
+        ret["reason"] = "author is incorrect";
+        auto resp = HttpResponse::newHttpJsonResponse(ret);
+        resp->setStatusCode(k400BadRequest);
+        callback(resp);
+        return;
+    }
+
+    if (activeExports.fetch_add(1, std::memory_order_relaxed) >= kMaxExports) {
+        activeExports.fetch_sub(1, std::memory_order_relaxed);
+        sendDebugError(
+            callback, "too many exports are running", k503ServiceUnavailable
+        );
+        return;
+    }
+    auto slot = std::make_shared<ExportSlot>();
+    auto transfer = std::make_shared<PostTransfer::Export>(
+        ShardRouter::instance().connectionStrings(), std::move(author)
+    );
+    auto resp = HttpResponse::newAsyncStreamResponse(
+        [transfer, slot, connection = req->getConnectionPtr()](
+            ResponseStreamPtr stream
+        ) {
+            std::thread(
+                pumpExport, transfer, std::move(stream), connection, slot
+            ).detach();
+        }
+    );
+    resp->setContentTypeCodeAndCustomString(CT_CUSTOM, "application/x-ndjson");
+    callback(resp);
+}
+
+void DebugController::transfer(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp =
+        HttpResponse::newHttpJsonResponse(PostTransfer::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::workers(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp =
+        HttpResponse::newHttpJsonResponse(Supervisor::instance().aggregate());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+void DebugController::pprof(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp = HttpResponse::newHttpJsonResponse(Profiler::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
+
+// Ответ приходит через ?seconds (по умолчанию 30) секунд.
+void DebugController::cpuProfile(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto &profiler = Profiler::instance();
+    if (!profiler.cpuSupported()) {
+        sendDebugError(
+            callback, "built without PRIYOMYSH_PROFILER", k501NotImplemented
+        );
+        return;
+    }
+    if (profiler.cpuRunning()) {
+        sendDebugError(callback, "cpu profile is already running", k409Conflict);
+        return;
+    }
+
+    int seconds = 30;
+    auto secondsParam = req->getParameter("seconds");
+    if (!secondsParam.empty()) {
+        try {
+            seconds = std::stoi(secondsParam);
+        } catch (const std::exception &) {
+            sendDebugError(callback, "seconds is incorrect", k400BadRequest);
+            return;
+        }
+    }
+
+    profiler.cpuProfile(
+        seconds, drogon::app().getLoop(),
+        [callback = std::move(callback)](
+            std::optional<std::string> profile, const std::string &error
+        ) {
+            if (!profile) {
+                sendDebugError(callback, error, k500InternalServerError);
+                return;
+            }
+            sendProfile(callback, std::move(*profile));
+        }
+    );
+}
+
+void DebugController::heapProfile(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    std::string error;
+    auto profile = Profiler::instance().heapProfile(error);
+    if (!profile) {
+        sendDebugError(
+            callback, error,
+            Profiler::instance().heapSupported() ? k500InternalServerError
+                                                 : k501NotImplemented
+        );
+        return;
+    }
+    sendProfile(callback, std::move(*profile));
+}
+
+void DebugController::singleFlight(
+    const HttpRequestPtr &req,
+    Callback &&callback
+) {
+    if (!checkDebugAccess(req)) {
+        sendDebugForbidden(callback);
+        return;
+    }
+
+    auto resp =
+        HttpResponse::newHttpJsonResponse(SingleFlight::instance().stats());
+    resp->setStatusCode(k200OK);
+    callback(resp);
+}
\ No newline at end of file
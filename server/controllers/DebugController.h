@@ -0,0 +1,67 @@
+#pragma once
+
+#include <drogon/HttpController.h>
+
+class DebugController : public drogon::HttpController<DebugController> {
+public:
+    METHOD_LIST_BEGIN
+        ADD_METHOD_TO(DebugController::topQueries, "/api/debug/queries", drogon::Get);
+        ADD_METHOD_TO(DebugController::liveStats, "/api/debug/live", drogon::Get);
+        ADD_METHOD_TO(DebugController::replicas, "/api/debug/replicas", drogon::Get);
+        ADD_METHOD_TO(DebugController::mediaStats, "/api/debug/media", drogon::Get);
+        ADD_METHOD_TO(DebugController::admission, "/api/debug/admission", drogon::Get);
+        ADD_METHOD_TO(DebugController::topology, "/api/debug/topology", drogon::Get);
+        ADD_METHOD_TO(DebugController::logging, "/api/debug/logging", drogon::Get);
+        ADD_METHOD_TO(DebugController::allocations, "/api/debug/alloc", drogon::Get);
+        ADD_METHOD_TO(DebugController::postCache, "/api/debug/post-cache", drogon::Get);
+        ADD_METHOD_TO(DebugController::warmup, "/api/debug/warmup", drogon::Get);
+        ADD_METHOD_TO(DebugController::availability, "/api/debug/availability", drogon::Get);
+        ADD_METHOD_TO(DebugController::idempotency, "/api/debug/idempotency", drogon::Get);
+        ADD_METHOD_TO(DebugController::exportPosts, "/api/debug/export", drogon::Get);
+        ADD_METHOD_TO(DebugController::transfer, "/api/debug/transfer", drogon::Get);
+        ADD_METHOD_TO(DebugController::workers, "/api/debug/workers", drogon::Get);
+        ADD_METHOD_TO(DebugController::singleFlight, "/api/debug/single-flight", drogon::Get);
+        ADD_METHOD_TO(DebugController::pprof, "/api/debug/pprof", drogon::Get);
+        ADD_METHOD_TO(DebugController::cpuProfile, "/api/debug/pprof/profile", drogon::Get);
+        ADD_METHOD_TO(DebugController::heapProfile, "/api/debug/pprof/heap", drogon::Get);
+    METHOD_LIST_END
+
+    void topQueries(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void liveStats(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void replicas(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void mediaStats(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void admission(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void topology(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void logging(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void allocations(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void postCache(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void warmup(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void availability(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void idempotency(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void exportPosts(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void transfer(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void workers(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void singleFlight(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void pprof(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void cpuProfile(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    void heapProfile(const drogon::HttpRequestPtr& req,
+            std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+};
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "FeedSocketController.h"
+#include "helpers.h"
+#include "services/FeedHub.h"
+
+using namespace drogon;
+
+void FeedSocketController::handleNewMessage(
+    const WebSocketConnectionPtr &conn,
+    std::string &&message,
+    const WebSocketMessageType &type
+) {
+    // Канал односторонний, входящие сообщения игнорируются.
+}
+
+// Браузер не может передать заголовок Authorization при открытии
+// WebSocket, поэтому токен также принимается в параметре access_token.
+void FeedSocketController::handleNewConnection(
+    const HttpRequestPtr &req,
+    const WebSocketConnectionPtr &conn
+) {
+    auto loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+    async_run([req, conn, loop]() -> Task<> {
+        auto token = req->getParameter("access_token");
+        auto loginOpt = token.empty() ? co_await verifyToken(req)
+                                      : co_await verifyBearerToken(token);
+        if (!loginOpt) {
+            conn->shutdown(CloseCode::kViolation, "Token is incorrect");
+            co_return;
+        }
+        loop->queueInLoop([conn,
+                           login = std::move(*loginOpt),
+                           tcp = req->getConnectionPtr()]() {
+            FeedHub::instance().subscribe(conn, login, tcp);
+        });
+    });
+}
+
+void FeedSocketController::handleConnectionClosed(
+    const WebSocketConnectionPtr &conn
+) {
+    FeedHub::instance().unsubscribe(conn);
+}
\ No newline at end of file
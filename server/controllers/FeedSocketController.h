@@ -0,0 +1,17 @@
+#pragma once
+
+#include <drogon/WebSocketController.h>
+
+class FeedSocketController : public drogon::WebSocketController<FeedSocketController> {
+public:
+    WS_PATH_LIST_BEGIN
+        WS_PATH_ADD("/api/posts/live");
+    WS_PATH_LIST_END
+
+    void handleNewMessage(const drogon::WebSocketConnectionPtr& conn,
+            std::string&& message,
+            const drogon::WebSocketMessageType& type) override;
+    void handleNewConnection(const drogon::HttpRequestPtr& req,
+            const drogon::WebSocketConnectionPtr& conn) override;
+    void handleConnectionClosed(const drogon::WebSocketConnectionPtr& conn) override;
+};
\ No newline at end of file
@@ -1,581 +1,1134 @@
-#include "PostsController.h"
+#include "PostsController.hpp"
 #include <drogon/HttpRequest.h>
 #include <drogon/HttpResponse.h>
 #include <drogon/HttpTypes.h>
-#include <trantor/utils/Date.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <iomanip>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 #include <sstream>
+#include "codec/Ascii.h"
+#include "codec/Cbor.h"
+#include "db/UuidV7.h"
 #include "helpers.h"
+#include "services/FeedHub.h"
+#include "services/IdempotencyStore.h"
+#include "services/MediaStore.h"
+#include "services/PostCache.h"
+#include "services/ReactionBuffer.h"
+#include "services/RequestArena.h"
 
 using namespace drogon;
 
-static void verifyToken(
-    const HttpRequestPtr &req,
-    std::function<void(std::optional<std::string>)> callback
-) {
-    auto auth = req->getHeader("Authorization");
-    if (auth.empty() || auth.substr(0, 7) != "Bearer ") {
-        std::cout << "nonBearer";
-        callback(std::nullopt);
-        return;
-    }
-    std::string token = auth.substr(7);
-    auto payload = getTokenContent(token);
-    if (!payload || payload->exp < std::chrono::system_clock::time_point()) {
-        std::cout << "time stuff";
-        callback(std::nullopt);
-        return;
-    }
-    auto db = getDbClient();
-    db->execSqlAsync(
-        R"sql(SELECT token_number FROM users WHERE login = $1)sql",
-        [payload, callback](const drogon::orm::Result &r) {
-            if (r.empty()) {
-                std::cout << "no such users";
-                callback(std::nullopt);
-                return;
-            }
-            int dbTokenNumber = r[0]["token_number"].as<int>();
-            if (dbTokenNumber != payload->token_number) {
-                std::cout << "wrong token_number";
-                callback(std::nullopt);
-                return;
-            }
-            callback(payload->login);
-        },
-        [callback](const drogon::orm::DrogonDbException &e) {
-            LOG_ERROR << e.base().what();
-            callback(std::nullopt);
-        },
-        payload->login
-    );
+static HttpResponsePtr
+jsonResponse(Json::Value &&body, HttpStatusCode code = k200OK) {
+    auto resp = HttpResponse::newHttpJsonResponse(std::move(body));
+    resp->setStatusCode(code);
+    return resp;
 }
 
-static void fetchPost(
-    const std::string &postId,
-    const std::string &currentLogin,
-    std::function<void(const Json::Value &, int)> callback
-) {
-    auto db = getDbClient();
-    db->execSqlAsync(
-        R"sql(SELECT p.*, u.is_public as author_public, 
-                     (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
-                     (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images
-                     FROM posts p JOIN users u ON u.login = p.author WHERE p.id_uuid = $1)sql",
-        [callback, currentLogin, db](const drogon::orm::Result &r) {
-            if (r.empty()) {
-                callback(Json::Value(), 404);
-                return;
-            }
-            auto row = r[0];
-            std::string author = row["author"].as<std::string>();
-            bool authorPublic = row["author_public"].as<bool>();
-            std::string imagesStr = row["images"].as<std::string>();
-            std::string tagsStr = row["tags1"].as<std::string>();
-            std::vector<std::string> tags;
-            if (!tagsStr.empty()) {
-                std::istringstream iss(tagsStr);
-                std::string tag;
-                while (std::getline(iss, tag, ',')) {
-                    tags.push_back(tag);
-                }
-            }
+static HttpResponsePtr
+errorResponse(const std::string &reason, HttpStatusCode code) {
+    Json::Value ret;
+    ret["reason"] = reason;
+    return jsonResponse(std::move(ret), code);
+}
 
-            if (author != currentLogin && !authorPublic) {
-                // здесь позже добавится проверка на то, является ли
-                // пользователь другом
-                callback(Json::Value(), 404);
-                return;
-            }
+static HttpResponsePtr unauthorized() {
+    return errorResponse("Token is incorrect", k401Unauthorized);
+}
 
-            Json::Value post;
-            post["id"] = row["id_uuid"].as<std::string>();
-            post["content"] = row["content"].as<std::string>();
-            post["author"] = author;
-            for (const auto &t : tags) {
-                post["tags"].append(t);
-            }
-            if (!imagesStr.empty()) {
-                std::istringstream iss(imagesStr);
-                std::string imgPath;
-                while (std::getline(iss, imgPath, ',')) {
-                    std::string base64 = loadImageAsBase64(imgPath);
-                    if (!base64.empty()) {
-                        post["img"].append(base64);
-                    }
-                }
-            }
-            post["createdAt"] = row["created_at"].as<std::string>();
-            post["likesCount"] = 0;
-            post["dislikesCount"] = 0;
-            callback(post, 200);
-        },
-        [callback](const drogon::orm::DrogonDbException &e) {
-            LOG_ERROR << e.base().what();
-            callback(Json::Value(), 500);
-        },
-        postId
-    );
+static HttpResponsePtr badRequest(const std::string &reason) {
+    return errorResponse(reason, k400BadRequest);
 }
 
-static std::pair<int, int> parseLimitOffset(const drogon::HttpRequestPtr &req) {
-    int limit = 5;
-    auto limitParam = req->getParameter("limit");
-    if (!limitParam.empty()) {
-        limit = std::stoi(limitParam);
-    }
-    int offset = 0;
-    auto offsetParam = req->getParameter("offset");
-    if (!offsetParam.empty()) {
-        offset = std::stoi(offsetParam);
-    }
-    return {limit, offset};
-}
-
-static Json::Value buildPostsJson(const drogon::orm::Result &r) {
-    Json::Value posts(Json::arrayValue);
-    for (const auto &row : r) {
-        Json::Value post;
-        post["id"] = row["id_uuid"].as<std::string>();
-        post["content"] = row["content"].as<std::string>();
-        post["author"] = row["author"].as<std::string>();
-
-        std::string tagsStr = row["tags1"].as<std::string>();
-        if (!tagsStr.empty()) {
-            std::istringstream iss(tagsStr);
-            std::string tag;
-            while (std::getline(iss, tag, ',')) {
-                post["tags"].append(tag);
+static HttpResponsePtr notFound(const std::string &reason) {
+    return errorResponse(reason, k404NotFound);
+}
+
+static HttpResponsePtr forbidden(const std::string &reason) {
+    return errorResponse(reason, k403Forbidden);
+}
+
+static HttpResponsePtr internalError() {
+    return errorResponse("Internal error", k500InternalServerError);
+}
+
+static HttpResponsePtr rawJsonResponse(std::string &&body) {
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setStatusCode(k200OK);
+    resp->setContentTypeCode(CT_APPLICATION_JSON);
+    resp->setBody(std::move(body));
+    return resp;
+}
+
+// Фрагмент из PostCache и актуальные счетчики реакций из строки.
+static void appendPostJson(std::string &out, const drogon::orm::Row &row) {
+    out += *PostCache::instance().fragment(row);
+    out += ",\"dislikesCount\":";
+    out += std::to_string(row["dislikes_count"].as<int64_t>());
+    out += ",\"likesCount\":";
+    out += std::to_string(row["likes_count"].as<int64_t>());
+    out += '}';
+}
+
+
+// Клиент может попросить CBOR: картинки тогда идут байтами, а createdAt
+// целым числом микросекунд от эпохи. application/cbor;q=0 означает отказ
+// от CBOR.
+static bool wantsCbor(const HttpRequestPtr &req) {
+    auto trim = [](std::string_view text) {
+        while (!text.empty() && text.front() == ' ') {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && text.back() == ' ') {
+            text.remove_suffix(1);
+        }
+        return text;
+    };
+    bool cbor = false;
+    forEachListItem(req->getHeader("Accept"), [&](std::string_view item) {
+        auto semicolon = item.find(';');
+        if (trim(item.substr(0, semicolon)) != "application/cbor") {
+            return;
+        }
+        double q = 1;
+        while (semicolon != std::string_view::npos) {
+            item.remove_prefix(semicolon + 1);
+            semicolon = item.find(';');
+            auto param = trim(item.substr(0, semicolon));
+            if (param.size() > 2 && param.substr(0, 2) == "q=") {
+                q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
             }
         }
+        cbor = q > 0;
+    });
+    return cbor;
+}
 
-        std::string imagesStr = row["images"].as<std::string>();
-        if (!imagesStr.empty()) {
-            std::istringstream iss(imagesStr);
-            std::string imgPath;
-            while (std::getline(iss, imgPath, ',')) {
-                std::string base64 = loadImageAsBase64(imgPath);
-                if (!base64.empty()) {
-                    post["img"].append(base64);
-                }
+// Ответ зависит от Accept в обоих форматах, поэтому Vary ставится и у JSON.
+static HttpResponsePtr negotiatedJsonResponse(std::string &&body) {
+    auto resp = rawJsonResponse(std::move(body));
+    resp->addHeader("Vary", "Accept");
+    return resp;
+}
+
+static HttpResponsePtr cborResponse(std::string &&body) {
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setStatusCode(k200OK);
+    resp->setContentTypeString("application/cbor");
+    resp->addHeader("Vary", "Accept");
+    resp->setBody(std::move(body));
+    return resp;
+}
+
+static void writePostCbor(CborWriter &out, const drogon::orm::Row &row) {
+    auto tagsJoined = row["tags1"].as<std::string>();
+    std::pmr::vector<std::string_view> tags(RequestArena::resource());
+    forEachListItem(tagsJoined, [&](std::string_view tag) {
+        tags.push_back(tag);
+    });
+    // Картинки одного поста живут до конца этой функции.
+    std::vector<std::vector<unsigned char>> images;
+    forEachListItem(
+        row["images"].as<std::string>(),
+        [&](std::string_view imgPath) {
+            if (auto image = readImage(std::string(imgPath))) {
+                images.push_back(std::move(*image));
             }
         }
+    );
 
-        post["createdAt"] = row["created_at"].as<std::string>();
-        // здесь потом добавлю подсчет лайков и дизлайков
-        post["likesCount"] = 0;
-        post["dislikesCount"] = 0;
-        posts.append(post);
+    out.map(8);
+    out.text("id");
+    out.text(row["id_uuid"].as<std::string>());
+    out.text("content");
+    out.text(row["content"].as<std::string>());
+    out.text("author");
+    out.text(row["author"].as<std::string>());
+    out.text("tags");
+    out.array(tags.size());
+    for (auto tag : tags) {
+        out.text(tag);
     }
-    return posts;
+    out.text("img");
+    out.array(images.size());
+    for (const auto &image : images) {
+        out.bytes(image.data(), image.size());
+    }
+    out.text("createdAt");
+    out.integer(createdAtUs(row));
+    out.text("likesCount");
+    out.integer(row["likes_count"].as<int64_t>());
+    out.text("dislikesCount");
+    out.integer(row["dislikes_count"].as<int64_t>());
 }
 
-static auto sendPostsResponse(Callback callback) {
-    return [callback](const drogon::orm::Result &r) {
-        auto resp =
-            drogon::HttpResponse::newHttpJsonResponse(buildPostsJson(r));
-        resp->setStatusCode(k200OK);
-        callback(resp);
-    };
+// Возвращает std::nullopt, если пост не найден или недоступен.
+static Task<std::optional<drogon::orm::Row>>
+fetchPost(const std::string &postId, const std::string &currentLogin) {
+    static const std::string sql = R"sql(
+        SELECT p.*, u.is_public as author_public,
+               epoch_us(p.created_at) as created_at_us,
+               (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+               (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+               COALESCE(c.likes, 0) as likes_count,
+               COALESCE(c.dislikes, 0) as dislikes_count
+        FROM posts p JOIN users u ON u.login = p.author
+        LEFT JOIN post_reaction_counts c ON c.post_id = p.id
+        WHERE p.id_uuid = $1 OR p.legacy_uuid = $1)sql";
+
+    auto &router = ShardRouter::instance();
+    std::optional<drogon::orm::Result> r;
+    auto shard = router.shardOfPost(postId);
+    if (shard) {
+        r = co_await router.shard(*shard)
+                .replicas->reader(currentLogin)
+                ->execSqlCoro(sql, postId);
+    }
+    // У постов, созданных до шардирования, номера шарда в uuid нет.
+    if ((!r || r->empty()) && (!shard || router.count() > 1)) {
+        for (auto &res :
+             co_await scatterSql(router.readers(currentLogin), sql, postId)) {
+            if (!res.empty()) {
+                r = std::move(res);
+                break;
+            }
+        }
+    }
+    if (!r || r->empty()) {
+        co_return std::nullopt;
+    }
+    auto row = (*r)[0];
+    bool authorPublic = row["author_public"].as<bool>();
+    if (row["author"].as<std::string>() != currentLogin && !authorPublic) {
+        // здесь позже добавится проверка на то, является ли
+        // пользователь другом
+        co_return std::nullopt;
+    }
+    co_return row;
 }
 
-static auto sendDbErrorResponse(Callback callback) {
-    return [callback](const drogon::orm::DrogonDbException &e) {
-        LOG_ERROR << e.base().what();
-        Json::Value ret;
-        ret["reason"] = "Internal error";
-        auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
-        resp->setStatusCode(k500InternalServerError);
-        callback(resp);
+// k-way слияние ответов шардов, каждый из которых уже отсортирован по
+// less. Возвращает строки [skip, skip + take) общего порядка.
+template <typename Less>
+static std::vector<drogon::orm::Row> mergeShardRows(
+    const std::vector<drogon::orm::Result> &results,
+    Less less,
+    size_t skip,
+    size_t take
+) {
+    using Cursor = std::pair<size_t, size_t>;
+    auto greater = [&](const Cursor &a, const Cursor &b) {
+        return less(results[b.first][b.second], results[a.first][a.second]);
     };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(
+        greater
+    );
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].empty()) {
+            heap.emplace(i, 0);
+        }
+    }
+    std::vector<drogon::orm::Row> rows;
+    rows.reserve(take);
+    while (!heap.empty() && rows.size() < take) {
+        auto [shard, index] = heap.top();
+        heap.pop();
+        if (skip > 0) {
+            --skip;
+        } else {
+            rows.push_back(results[shard][index]);
+        }
+        if (index + 1 < results[shard].size()) {
+            heap.emplace(shard, index + 1);
+        }
+    }
+    return rows;
 }
 
-static void sendUnauthorized(Callback callback) {
-    Json::Value ret;
-    ret["reason"] = "Token is incorrect";
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
-    resp->setStatusCode(k401Unauthorized);
-    callback(resp);
+// Порядок ленты: новые посты первыми, при равном времени по id_uuid.
+static bool newerPost(const drogon::orm::Row &a, const drogon::orm::Row &b) {
+    auto aCreated = createdAtUs(a);
+    auto bCreated = createdAtUs(b);
+    if (aCreated != bCreated) {
+        return aCreated > bCreated;
+    }
+    return a["id_uuid"].as<std::string>() > b["id_uuid"].as<std::string>();
 }
 
-static void sendBadRequest(const std::string &reason, Callback callback) {
-    Json::Value ret;
-    ret["reason"] = reason;
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
-    resp->setStatusCode(k400BadRequest);
-    callback(resp);
+// Возвращает std::nullopt, если limit или offset некорректны.
+static std::optional<std::pair<int, int>>
+parseLimitOffset(const drogon::HttpRequestPtr &req) {
+    int limit = 5;
+    int offset = 0;
+    try {
+        auto limitParam = req->getParameter("limit");
+        if (!limitParam.empty()) {
+            limit = std::stoi(limitParam);
+        }
+        auto offsetParam = req->getParameter("offset");
+        if (!offsetParam.empty()) {
+            offset = std::stoi(offsetParam);
+        }
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+    if (limit < 0 || offset < 0) {
+        return std::nullopt;
+    }
+    return std::make_pair(limit, offset);
 }
 
-static void sendNotFound(const std::string &reason, Callback callback) {
-    Json::Value ret;
-    ret["reason"] = reason;
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
-    resp->setStatusCode(k404NotFound);
-    callback(resp);
+// Массив постов собирается из готовых фрагментов без промежуточного
+// Json::Value.
+template <typename Rows>
+static std::string postsJsonArray(const Rows &rows) {
+    std::string out = "[";
+    for (const auto &row : rows) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        appendPostJson(out, row);
+    }
+    out += ']';
+    return out;
 }
 
-static void sendForbidden(const std::string &reason, Callback callback) {
-    Json::Value ret;
-    ret["reason"] = reason;
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
-    resp->setStatusCode(k403Forbidden);
-    callback(resp);
+template <typename Rows>
+static HttpResponsePtr
+postsResponse(const HttpRequestPtr &req, const Rows &rows) {
+    if (!wantsCbor(req)) {
+        return negotiatedJsonResponse(postsJsonArray(rows));
+    }
+    CborWriter out;
+    out.array(rows.size());
+    for (const auto &row : rows) {
+        writePostCbor(out, row);
+    }
+    return cborResponse(out.release());
 }
 
-static void sendInternalError(Callback callback) {
-    Json::Value ret;
-    ret["reason"] = "Internal error";
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
-    resp->setStatusCode(k500InternalServerError);
-    callback(resp);
+static HttpResponsePtr dbError(const drogon::orm::DrogonDbException &e) {
+    LOG_ERROR << e.base().what();
+    return internalError();
 }
 
-static void saveImages(
-    int postId,
+// Картинки пишутся на диск до вставки поста, а строки media уходят в базу
+// тем же запросом, что и пост, в виде литералов массивов путей и хешей.
+static Task<bool> storeImages(
+    const std::string &postUuid,
     const Json::Value &imgArray,
-    const Json::Value &postJson,
-    std::function<void(const drogon::HttpResponsePtr &)> callback
+    std::string &paths,
+    std::string &hashes
 ) {
-    LOG_INFO << "saveImages called, postId=" << postId
-             << ", imgArray size=" << imgArray.size();
-    try {
-        if (imgArray.empty()) {
-            LOG_INFO << "No images, sending response";
-            auto resp = drogon::HttpResponse::newHttpJsonResponse(postJson);
-            resp->setStatusCode(k200OK);
-            callback(resp);
-            return;
+    paths = "{";
+    hashes = "{";
+    for (const auto &img : imgArray) {
+        auto stored = co_await runOnCpuPool([&]() {
+            return MediaStore::instance().put(img.asString());
+        });
+        if (!stored) {
+            co_return false;
         }
+        AsyncLog::instance().event(
+            "media", "image stored",
+            {{"post", postUuid},
+             {"hash", stored->hash},
+             {"dedup", stored->deduplicated ? "1" : "0"}}
+        );
+        appendPgArrayItem(paths, stored->path);
+        appendPgArrayItem(hashes, stored->hash);
+    }
+    paths += '}';
+    hashes += '}';
+    co_return true;
+}
 
-        const std::string mediaDir = "../media/";
-        if (!std::filesystem::exists(mediaDir)) {
-            std::filesystem::create_directory(mediaDir);
-        }
+// Захват Idempotency-Key снимается, если пост так и не был создан.
+struct IdempotencyClaim {
+    TimedDbClientPtr db;
+    std::string login;
+    std::string key;
+    bool active = false;
 
-        auto db = getDbClient();
-        for (const auto &img : imgArray) {
-            if (!img.isString()) {
-                LOG_ERROR << "Invalid image entry (not a string)";
-                sendBadRequest("Invalid image entry", callback);
-                return;
-            }
-            std::string base64 = img.asString();
-            std::string filename = generateFilename(".jpg");
-            std::string filePath = mediaDir + filename;
-            LOG_INFO << "Saving image to " << filePath;
-            if (!saveBase64(base64, filePath)) {
-                LOG_ERROR << "Failed to save base64 image to " << filePath;
-                sendInternalError(callback);
-                return;
-            }
-            // try {
-            //     db->execSqlSync("INSERT INTO media (id_post, img) VALUES ($1,
-            //     $2)", postId, filePath); LOG_INFO << "Inserted into media:
-            //     postId=" << postId << ", path=" << filePath;
-            // } catch (const drogon::orm::DrogonDbException& e) {
-            //     LOG_ERROR << "DB insert error: " << e.base().what();
-            //     sendInternalError(callback);
-            //     return;
-            // }
-            db->execSqlAsync(
-                "INSERT INTO media (id_post, img) VALUES ($1, $2)",
-                [callback, postJson](const drogon::orm::Result &) {
-                    LOG_INFO << "Insert successful, sending response";
-                    auto resp =
-                        drogon::HttpResponse::newHttpJsonResponse(postJson);
-                    resp->setStatusCode(k200OK);
-                    callback(resp);
-                },
-                [callback](const drogon::orm::DrogonDbException &e) {
-                    LOG_ERROR << "Insert error: " << e.base().what();
-                    sendInternalError(callback);
-                },
-                postId, filePath
-            );
+    ~IdempotencyClaim() {
+        if (active) {
+            IdempotencyStore::instance().release(db, login, key);
         }
-        LOG_INFO << "All images saved, sending response";
-        auto resp = drogon::HttpResponse::newHttpJsonResponse(postJson);
-        resp->setStatusCode(k200OK);
-        callback(resp);
-    } catch (const std::exception &e) {
-        LOG_ERROR << "Exception in saveImages: " << e.what();
-        sendInternalError(callback);
     }
-}
+};
 
-void PostsController::newPost(const HttpRequestPtr &req, Callback &&callback) {
-    verifyToken(req, [callback, req](std::optional<std::string> loginOpt) {
-        if (!loginOpt) {
-            Json::Value ret;
-            ret["reason"] = "Token is incorrect";
-            auto resp = HttpResponse::newHttpJsonResponse(ret);
-            resp->setStatusCode(k401Unauthorized);
-            callback(resp);
-            return;
+Task<HttpResponsePtr> PostsController::newPost(HttpRequestPtr req) {
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
+    std::string login = std::move(*loginOpt);
+
+    auto json = req->getJsonObject();
+    if (!json) {
+        co_return badRequest("Tags or content are incorrect");
+    }
+
+    // tags и img читаются по ссылке из тела запроса, которое живет, пока
+    // жив req; base64 изображений не копируется.
+    static const Json::Value emptyArray(Json::arrayValue);
+    static const Json::Value nullValue;
+    const Json::Value &body = *json;
+    auto content = body["content"].asString();
+    const Json::Value &tags =
+        body.isMember("tags") ? body["tags"] : nullValue;
+    if (!tags.isArray() || content.empty() || content.size() > 1000) {
+        co_return badRequest("Tags or content are incorrect");
+    }
+    if (tags.size() > 20) {
+        co_return badRequest("Too many tags");
+    }
+    for (const auto &tag : tags) {
+        if (!tag.isString() || tag.asString().size() > 20) {
+            co_return badRequest("Tag too long or invalid");
         }
-        std::string login = *loginOpt;
+    }
 
-        auto json = req->getJsonObject();
-        if (!json) {
-            Json::Value ret;
-            ret["reason"] = "Tags or content are incorrect";
-            auto resp = HttpResponse::newHttpJsonResponse(ret);
-            resp->setStatusCode(k400BadRequest);
-            callback(resp);
-            return;
+    const Json::Value &imgArray =
+        body.isMember("img") ? body["img"] : emptyArray;
+    if (!imgArray.isArray()) {
+        co_return badRequest("Invalid img field");
+    }
+    for (const auto &img : imgArray) {
+        if (!img.isString()) {
+            LOG_ERROR << "Invalid image entry (not a string)";
+            co_return badRequest("Invalid image entry");
         }
+    }
 
-        auto content = (*json)["content"].asString();
-        auto tags = (*json)["tags"];
-        if (!tags.isArray() || content.empty() || content.size() > 1000) {
-            Json::Value ret;
-            ret["reason"] = "Tags or content are incorrect";
-            auto resp = HttpResponse::newHttpJsonResponse(ret);
-            resp->setStatusCode(k400BadRequest);
-            callback(resp);
-            return;
+    auto &shard = ShardRouter::instance().forLogin(login);
+    auto db = shard.primary;
+
+    // Клиенты повторяют запрос по таймауту; повтор с тем же ключом
+    // получает ответ первого запроса без новой записи поста и картинок.
+    IdempotencyClaim claim;
+    const auto &idempotencyKey = req->getHeader("Idempotency-Key");
+    if (!idempotencyKey.empty()) {
+        if (idempotencyKey.size() > 255) {
+            co_return badRequest("Idempotency-Key is too long");
         }
-        if (tags.size() > 20) {
-            Json::Value ret;
-            ret["reason"] = "Too many tags";
-            auto resp = HttpResponse::newHttpJsonResponse(ret);
-            resp->setStatusCode(k400BadRequest);
-            callback(resp);
-            return;
+        auto raw = req->body();
+        IdempotencyStore::Result result;
+        try {
+            result = co_await IdempotencyStore::instance().claim(
+                db, login, idempotencyKey,
+                drogon::utils::getSha256(raw.data(), raw.size())
+            );
+        } catch (const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << e.base().what();
+            co_return errorResponse(
+                "Post creation failed", k500InternalServerError
+            );
         }
-        for (const auto &tag : tags) {
-            if (!tag.isString() || tag.asString().size() > 20) {
-                Json::Value ret;
-                ret["reason"] = "Tag too long or invalid";
-                auto resp = HttpResponse::newHttpJsonResponse(ret);
-                resp->setStatusCode(k400BadRequest);
-                callback(resp);
-                return;
+        switch (result.status) {
+            case IdempotencyStore::Status::Owned:
+                claim.db = db;
+                claim.login = login;
+                claim.key = idempotencyKey;
+                claim.active = true;
+                break;
+            case IdempotencyStore::Status::Replay: {
+                auto resp = rawJsonResponse(std::move(result.response));
+                resp->addHeader("Idempotent-Replayed", "true");
+                co_return resp;
             }
+            case IdempotencyStore::Status::InProgress:
+                co_return errorResponse(
+                    "Request with this Idempotency-Key is in progress",
+                    k409Conflict
+                );
+            case IdempotencyStore::Status::Mismatch:
+                co_return errorResponse(
+                    "Idempotency-Key was used with a different request",
+                    k422UnprocessableEntity
+                );
         }
+    }
 
-        auto imgArray = json->get("img", Json::arrayValue);
-        if (!imgArray.isArray()) {
-            sendBadRequest("Invalid img field", callback);
-            return;
+    // created_at совпадает со временем внутри UUIDv7, поэтому id поста
+    // годится курсором для постраничного чтения ленты. В базу время
+    // уходит целым числом микросекунд в двоичном виде.
+    std::string uuid = ShardRouter::instance().newPostUuid(shard.index);
+    int64_t createdAt = *uuidV7Millis(uuid) * 1000;
+
+    std::string paths, hashes;
+    try {
+        if (!co_await storeImages(uuid, imgArray, paths, hashes)) {
+            co_return internalError();
         }
+    } catch (const std::exception &e) {
+        LOG_ERROR << "Exception in storeImages: " << e.what();
+        co_return internalError();
+    }
 
-        auto db = getDbClient();
-        auto now = trantor::Date::now();
-        std::string createdAt =
-            now.toCustomFormattedString("%Y-%m-%dT%H:%M:%S", true);
-
-        db->execSqlAsync(
-            R"sql(INSERT INTO posts (content, author, created_at) VALUES ($1, $2, 
-            $3) RETURNING id, id_uuid)sql",
-            [callback, tags, createdAt, login, content,
-             imgArray](const drogon::orm::Result &r) {
-                if (r.empty()) {
-                    Json::Value ret;
-                    ret["reason"] = "Post creation failed";
-                    auto resp = HttpResponse::newHttpJsonResponse(ret);
-                    resp->setStatusCode(k500InternalServerError);
-                    callback(resp);
-                    return;
-                }
-                int postId = r[0]["id"].as<int>();
-                std::string uuid = r[0]["id_uuid"].as<std::string>();
-
-                auto db2 = getDbClient();
-                for (const auto &tag : tags) {
-                    db2->execSqlAsync(
-                        R"sql(INSERT INTO tags (id_post, tag) VALUES ($1, $2))sql",
-                        [](const drogon::orm::Result &) {},
-                        [](const drogon::orm::DrogonDbException &e) {
-                            LOG_ERROR << e.base().what();
-                        },
-                        postId, tag.asString()
-                    );
-                }
+    std::string tagArray = "{";
+    for (const auto &tag : tags) {
+        appendPgArrayItem(tagArray, tag.asString());
+    }
+    tagArray += '}';
 
-                Json::Value post;
-                post["id"] = uuid;
-                post["content"] = content;
-                post["author"] = login;
-                for (const auto &tag : tags) {
-                    post["tags"].append(tag.asString());
-                }
-                post["createdAt"] = createdAt;
-                post["likesCount"] = 0;
-                post["dislikesCount"] = 0;
-
-                saveImages(postId, imgArray, post, callback);
-            },
-            [callback](const drogon::orm::DrogonDbException &e) {
-                LOG_ERROR << e.base().what();
-                Json::Value ret;
-                ret["reason"] = "Post creation failed";
-
-                auto resp = HttpResponse::newHttpJsonResponse(ret);
-                resp->setStatusCode(k500InternalServerError);
-                callback(resp);
-            },
-            content, login, createdAt
+    // Пост, теги и картинки вставляются одним запросом: читатель, в том
+    // числе с реплики, видит либо весь пост, либо ничего, и в PostCache не
+    // попадает фрагмент без тегов или картинок.
+    bool authorPublic;
+    Json::Value post;
+    try {
+        auto r = co_await db->execSqlCoro(
+            R"sql(
+                WITH p AS (
+                    INSERT INTO posts (id_uuid, content, author, created_at)
+                    VALUES ($1::uuid, $2, $3, from_epoch_us($4))
+                    RETURNING id, id_uuid
+                ),
+                t AS (
+                    INSERT INTO tags (id_post, tag)
+                    SELECT p.id, tag FROM p, unnest($5::varchar[]) AS tag
+                ),
+                m AS (
+                    INSERT INTO media (id_post, img, hash)
+                    SELECT p.id, i.img, i.hash
+                    FROM p, unnest($6::text[], $7::text[]) AS i(img, hash)
+                )
+                SELECT p.id_uuid,
+                       (SELECT is_public FROM users WHERE login = $3) as author_public
+                FROM p
+            )sql",
+            uuid, content, login, createdAt,
+            std::move(tagArray), std::move(paths), std::move(hashes)
         );
-    });
-}
-
-void PostsController::getPost(
-    const HttpRequestPtr &req,
-    Callback &&callback,
-    std::string postId
-) {
-    verifyToken(
-        req,
-        [callback, req, postId](std::optional<std::string> loginOpt) {
-            if (!loginOpt) {
-                sendUnauthorized(callback);
-                return;
-            }
-            std::string currentLogin = *loginOpt;
-
-            fetchPost(
-                postId, currentLogin,
-                [callback, postId](const Json::Value &post, int status) {
-                    if (status == 404) {
-                        sendNotFound("The post is not found", callback);
-                        return;
-                    }
-                    if (status != 200) {
-                        sendInternalError(callback);
-                        return;
-                    }
-                    // здесь потом добавить подсчет лайков
-                    auto resp = HttpResponse::newHttpJsonResponse(post);
-                    resp->setStatusCode(k200OK);
-                    callback(resp);
-                }
+        if (r.empty()) {
+            co_return errorResponse(
+                "Post creation failed", k500InternalServerError
             );
         }
+        authorPublic = r[0]["author_public"].as<bool>();
+        post["id"] = r[0]["id_uuid"].as<std::string>();
+    } catch (const drogon::orm::DrogonDbException &e) {
+        LOG_ERROR << e.base().what();
+        co_return errorResponse("Post creation failed", k500InternalServerError);
+    }
+
+    post["content"] = std::move(content);
+    post["author"] = std::move(login);
+    for (const auto &tag : tags) {
+        post["tags"].append(tag.asString());
+    }
+    post["createdAt"] = formatIsoTimestampUs(createdAt);
+    post["likesCount"] = 0;
+    post["dislikesCount"] = 0;
+
+    shard.replicas->markWrite(post["author"].asString());
+    FeedHub::instance().publish(
+        post["id"].asString(), post["author"].asString(), authorPublic
     );
+
+    static const Json::StreamWriterBuilder writer = [] {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        return builder;
+    }();
+    auto response = Json::writeString(writer, post);
+    if (claim.active) {
+        IdempotencyStore::instance().complete(
+            db, claim.login, claim.key, response
+        );
+        claim.active = false;
+    }
+    co_return rawJsonResponse(std::move(response));
 }
 
-void PostsController::myFeed(const HttpRequestPtr &req, Callback &&callback) {
-    verifyToken(req, [callback, req](std::optional<std::string> loginOpt) {
-        if (!loginOpt) {
-            sendUnauthorized(callback);
-            return;
-        }
-        std::string currentLogin = *loginOpt;
-        auto [lim, off] = parseLimitOffset(req);
-        int limit = lim, offset = off;
+Task<HttpResponsePtr>
+PostsController::getPost(HttpRequestPtr req, std::string postId) {
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
 
-        if (limit < 0 || offset < 0) {
-            sendBadRequest("limit or offset is incorrect", callback);
-            return;
-        }
+    std::optional<drogon::orm::Row> row;
+    try {
+        row = co_await fetchPost(postId, *loginOpt);
+    } catch (const drogon::orm::DrogonDbException &e) {
+        co_return dbError(e);
+    }
+    if (!row) {
+        co_return notFound("The post is not found");
+    }
+    RequestArena arena("post");
+    if (wantsCbor(req)) {
+        CborWriter out;
+        writePostCbor(out, *row);
+        co_return cborResponse(out.release());
+    }
+    std::string body;
+    appendPostJson(body, *row);
+    co_return negotiatedJsonResponse(std::move(body));
+}
 
-        auto db = getDbClient();
-        db->execSqlAsync(
+Task<HttpResponsePtr> PostsController::myFeed(HttpRequestPtr req) {
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
+    auto page = parseLimitOffset(req);
+    if (!page) {
+        co_return badRequest("limit or offset is incorrect");
+    }
+
+    try {
+        auto r = co_await getReadDbClient(*loginOpt, *loginOpt)->execSqlCoro(
             R"sql(
-                SELECT p.id_uuid, p.content, p.author, p.created_at,
+                SELECT p.id_uuid, p.version, p.content, p.author,
+                       epoch_us(p.created_at) as created_at_us,
                        (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
-                       (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images
+                       (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+                       COALESCE(c.likes, 0) as likes_count,
+                       COALESCE(c.dislikes, 0) as dislikes_count
                 FROM posts p
+                LEFT JOIN post_reaction_counts c ON c.post_id = p.id
                 WHERE p.author = $1
                 ORDER BY p.created_at DESC
                 LIMIT $2 OFFSET $3
             )sql",
-            sendPostsResponse(callback), sendDbErrorResponse(callback),
-            currentLogin, std::to_string(limit), std::to_string(offset)
+            std::move(*loginOpt), std::to_string(page->first),
+            std::to_string(page->second)
         );
-    });
+        RequestArena arena("feed.my");
+        co_return postsResponse(req, r);
+    } catch (const drogon::orm::DrogonDbException &e) {
+        co_return dbError(e);
+    }
 }
 
-void PostsController::userFeed(
-    const HttpRequestPtr &req,
-    Callback &&callback,
-    std::string login
-) {
-    verifyToken(
-        req,
-        [callback, req, login](std::optional<std::string> currentLoginOpt) {
-            if (!currentLoginOpt) {
-                sendUnauthorized(callback);
-                return;
+Task<HttpResponsePtr>
+PostsController::userFeed(HttpRequestPtr req, std::string login) {
+    auto currentLoginOpt = co_await verifyToken(req);
+    if (!currentLoginOpt) {
+        co_return unauthorized();
+    }
+    auto page = parseLimitOffset(req);
+    if (!page) {
+        co_return badRequest("limit or offset is incorrect");
+    }
+
+    // Когда у популярного автора выходит пост, его ленту одновременно
+    // запрашивают сотни клиентов с одинаковыми параметрами: такие чтения
+    // склеиваются в один запрос к базе.
+    auto db = getReadDbClient(login, *currentLoginOpt);
+    try {
+        auto r = co_await db->execSqlShared(
+            *currentLoginOpt,
+            R"sql(SELECT is_public FROM users WHERE login = $1)sql", login
+        );
+        if (r.empty()) {
+            co_return notFound("User not found");
+        }
+        bool isPublic = r[0]["is_public"].as<bool>();
+        if (*currentLoginOpt != login && !isPublic) {
+            // здесь потом добавить проверку на друзей
+            co_return forbidden("You are not allowed to see this profile");
+        }
+        r = co_await db->execSqlShared(
+            *currentLoginOpt,
+            R"sql(
+                SELECT p.id_uuid, p.version, p.content, p.author,
+                       epoch_us(p.created_at) as created_at_us,
+                       (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+                       (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+                       COALESCE(c.likes, 0) as likes_count,
+                       COALESCE(c.dislikes, 0) as dislikes_count
+                FROM posts p
+                LEFT JOIN post_reaction_counts c ON c.post_id = p.id
+                WHERE p.author = $1
+                ORDER BY p.created_at DESC
+                LIMIT $2::integer OFFSET $3::integer
+            )sql",
+            login, std::to_string(page->first), std::to_string(page->second)
+        );
+        RequestArena arena("feed.user");
+        co_return postsResponse(req, r);
+    } catch (const drogon::orm::DrogonDbException &e) {
+        co_return dbError(e);
+    }
+}
+
+// Позиция поста-курсора ленты: его created_at и текущий id_uuid. Время
+// берется из строки, а не из UUIDv7: у перенесенных постов оно точнее
+// миллисекунды, а у старых UUIDv4 его в id нет вовсе.
+static Task<std::optional<std::pair<int64_t, std::string>>>
+feedCursor(const std::string &reader, const std::string &postId) {
+    static const std::string sql = R"sql(
+        SELECT p.id_uuid, epoch_us(p.created_at) as created_at_us
+        FROM posts p
+        WHERE p.id_uuid = $1 OR p.legacy_uuid = $1)sql";
+
+    auto &router = ShardRouter::instance();
+    std::optional<drogon::orm::Result> r;
+    auto shard = router.shardOfPost(postId);
+    if (shard) {
+        r = co_await router.shard(*shard)
+                .replicas->reader(reader)
+                ->execSqlCoro(sql, postId);
+    }
+    if ((!r || r->empty()) && (!shard || router.count() > 1)) {
+        for (auto &res :
+             co_await scatterSql(router.readers(reader), sql, postId)) {
+            if (!res.empty()) {
+                r = std::move(res);
+                break;
             }
-            std::string currentLogin = *currentLoginOpt;
-            auto [lim, off] = parseLimitOffset(req);
-            int limit = lim, offset = off;
+        }
+    }
+    if (!r || r->empty()) {
+        co_return std::nullopt;
+    }
+    auto row = (*r)[0];
+    co_return std::make_pair(
+        createdAtUs(row), row["id_uuid"].as<std::string>()
+    );
+}
+
+constexpr int64_t kMaxScatterDepth = 1000;
 
-            if (limit < 0 || offset < 0) {
-                sendBadRequest("limit or offset is incorrect", callback);
-                return;
+Task<HttpResponsePtr> PostsController::newsFeed(HttpRequestPtr req) {
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
+    auto page = parseLimitOffset(req);
+    if (!page) {
+        co_return badRequest("limit or offset is incorrect");
+    }
+    // Курсор before — id последнего поста предыдущей страницы. Его
+    // created_at читается из базы один раз, дальше условие одинаково на
+    // всех шардах.
+    const auto &before = req->getParameter("before");
+    if (!before.empty() && (!validateUuid(before) || page->second != 0)) {
+        co_return badRequest("before is incorrect");
+    }
+
+    // потом здесь надо сделать проверку на друзей, пока что лента состоит
+    // только из постов пользователей с публичным аккаунтом
+    static const std::string sql = R"sql(
+        SELECT p.id_uuid, p.version, p.content, p.author,
+               epoch_us(p.created_at) as created_at_us,
+               (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+               (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+               COALESCE(c.likes, 0) as likes_count,
+               COALESCE(c.dislikes, 0) as dislikes_count
+        FROM posts p
+        LEFT JOIN post_reaction_counts c ON c.post_id = p.id
+        JOIN users u ON u.login = p.author
+        WHERE u.is_public = true
+        ORDER BY p.created_at DESC, p.id_uuid DESC
+        LIMIT $1 OFFSET $2
+    )sql";
+    static const std::string keysetSql = R"sql(
+        SELECT p.id_uuid, p.version, p.content, p.author,
+               epoch_us(p.created_at) as created_at_us,
+               (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+               (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+               COALESCE(c.likes, 0) as likes_count,
+               COALESCE(c.dislikes, 0) as dislikes_count
+        FROM posts p
+        LEFT JOIN post_reaction_counts c ON c.post_id = p.id
+        JOIN users u ON u.login = p.author
+        WHERE u.is_public = true
+          AND (p.created_at, p.id_uuid) < (from_epoch_us($2), $3::uuid)
+        ORDER BY p.created_at DESC, p.id_uuid DESC
+        LIMIT $1
+    )sql";
+    auto &router = ShardRouter::instance();
+    auto [limit, offset] = *page;
+    try {
+        if (!before.empty()) {
+            auto cursor = co_await feedCursor(*loginOpt, before);
+            if (!cursor) {
+                co_return badRequest("before is incorrect");
             }
+            auto results = co_await scatterSql(
+                router.readers(*loginOpt), keysetSql, std::to_string(limit),
+                cursor->first, cursor->second
+            );
+            RequestArena arena("feed.news");
+            co_return postsResponse(
+                req, mergeShardRows(results, newerPost, 0, limit)
+            );
+        }
+        if (router.count() == 1) {
+            auto r = co_await router.shard(0)
+                         .replicas->reader(*loginOpt)
+                         ->execSqlCoro(
+                             sql, std::to_string(limit), std::to_string(offset)
+                         );
+            RequestArena arena("feed.news");
+            co_return postsResponse(req, r);
+        }
+        // Каждый шард отдает первые limit + offset постов, страница
+        // собирается слиянием. Глубже kMaxScatterDepth листать только
+        // курсором before.
+        int64_t depth = int64_t(limit) + offset;
+        if (depth > kMaxScatterDepth) {
+            co_return badRequest("offset is too deep, use before");
+        }
+        auto results = co_await scatterSql(
+            router.readers(*loginOpt), sql, std::to_string(depth),
+            std::string("0")
+        );
+        RequestArena arena("feed.news");
+        co_return postsResponse(
+            req, mergeShardRows(results, newerPost, offset, limit)
+        );
+    } catch (const drogon::orm::DrogonDbException &e) {
+        co_return dbError(e);
+    }
+}
 
-            auto db = getDbClient();
-            db->execSqlAsync(
-                R"sql(SELECT is_public FROM users WHERE login = $1)sql",
-                [callback, db, currentLogin, login, limit,
-                 offset](const drogon::orm::Result &r) {
-                    if (r.empty()) {
-                        sendNotFound("User not found", callback);
-                        return;
-                    }
-                    bool isPublic = r[0]["is_public"].as<bool>();
-                    if (currentLogin != login && !isPublic) {
-                        // здесь потом добавить проверку на друзей
-                        sendForbidden(
-                            "You are not allowed to see this profile", callback
-                        );
-                        return;
-                    }
-                    db->execSqlAsync(
-                        R"sql(
-                        SELECT p.id_uuid, p.content, p.author, p.created_at,
-                               (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1, 
-                               (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images
-                        FROM posts p
-                        WHERE p.author = $1
-                        ORDER BY p.created_at DESC
-                        LIMIT $2::integer OFFSET $3::integer
-                    )sql",
-                        sendPostsResponse(callback),
-                        sendDbErrorResponse(callback), login,
-                        std::to_string(limit), std::to_string(offset)
-                    );
-                },
-                sendDbErrorResponse(callback), login
+// Реакция попадает в ReactionBuffer и доходит до базы при ближайшем
+// сбросе, поэтому ответ 202.
+static Task<HttpResponsePtr> react(
+    const HttpRequestPtr &req,
+    const std::string &postId,
+    ReactionBuffer::Value value
+) {
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
+    if (!validateUuid(postId)) {
+        co_return notFound("The post is not found");
+    }
+    ReactionBuffer::instance().add(postId, *loginOpt, value);
+    Json::Value ret;
+    ret["status"] = "accepted";
+    co_return jsonResponse(std::move(ret), k202Accepted);
+}
+
+Task<HttpResponsePtr>
+PostsController::likePost(HttpRequestPtr req, std::string postId) {
+    co_return co_await react(req, postId, ReactionBuffer::Like);
+}
+
+Task<HttpResponsePtr>
+PostsController::dislikePost(HttpRequestPtr req, std::string postId) {
+    co_return co_await react(req, postId, ReactionBuffer::Dislike);
+}
+
+Task<HttpResponsePtr>
+PostsController::removeReaction(HttpRequestPtr req, std::string postId) {
+    co_return co_await react(req, postId, ReactionBuffer::None);
+}
+
+// Курсор поиска: "<rank>_<uuid>" при поиске по тексту и
+// "<created_at_us>_<uuid>" при поиске только по тегу. uuid сравниваются
+// одинаково в Postgres и здесь, поэтому порядок на всех шардах общий.
+static bool parseSearchCursor(
+    const std::string &cursor,
+    bool ranked,
+    std::string &key,
+    std::string &uuid
+) {
+    auto sep = cursor.rfind('_');
+    if (sep == std::string::npos) {
+        return false;
+    }
+    // Ключ передается обратно в том виде, в котором его вернул Postgres,
+    // чтобы сравнение было точным.
+    key = cursor.substr(0, sep);
+    uuid = cursor.substr(sep + 1);
+    if (!validateUuid(uuid)) {
+        return false;
+    }
+    if (!ranked) {
+        return !key.empty() && key.size() <= 19 &&
+               key.find_first_not_of("0123456789") == std::string::npos;
+    }
+    try {
+        size_t used = 0;
+        std::stof(key, &used);
+        return used == key.size();
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+static bool higherRank(const drogon::orm::Row &a, const drogon::orm::Row &b) {
+    auto aRank = a["rank"].as<double>();
+    auto bRank = b["rank"].as<double>();
+    if (aRank != bRank) {
+        return aRank > bRank;
+    }
+    return a["id_uuid"].as<std::string>() > b["id_uuid"].as<std::string>();
+}
+
+Task<HttpResponsePtr> PostsController::search(HttpRequestPtr req) {
+    static std::atomic<int> inFlight{0};
+    static const Json::Value &config = app().getCustomConfig()["search"];
+    static const int maxInFlight = config.get("max_in_flight", 8).asInt();
+    static const int maxLimit = config.get("max_limit", 50).asInt();
+
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
+
+    const auto &q = req->getParameter("q");
+    const auto &tag = req->getParameter("tag");
+    if ((q.empty() && tag.empty()) || q.size() > 200 || tag.size() > 20) {
+        co_return badRequest("q or tag is incorrect");
+    }
+    auto page = parseLimitOffset(req);
+    if (!page || page->first > maxLimit) {
+        co_return badRequest("limit is incorrect");
+    }
+    int limit = page->first;
+
+    bool ranked = !q.empty();
+    // from_epoch_us превращает максимальный int64 в 'infinity'.
+    std::string cursorKey =
+        ranked ? "Infinity" : std::to_string(INT64_MAX);
+    std::string cursorUuid = "ffffffff-ffff-ffff-ffff-ffffffffffff";
+    const auto &cursor = req->getParameter("cursor");
+    if (!cursor.empty() &&
+        !parseSearchCursor(cursor, ranked, cursorKey, cursorUuid)) {
+        co_return badRequest("cursor is incorrect");
+    }
+
+    if (inFlight.fetch_add(1) >= maxInFlight) {
+        --inFlight;
+        co_return errorResponse("Too many searches", k503ServiceUnavailable);
+    }
+
+    auto clients = ShardRouter::instance().searchClients();
+    std::vector<drogon::orm::Result> results;
+    try {
+        if (ranked) {
+            results = co_await scatterSql(
+                clients,
+                R"sql(
+                    SELECT p.id_uuid, p.version, p.content, p.author,
+                           epoch_us(p.created_at) as created_at_us,
+                           (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+                           (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+                           COALESCE(c.likes, 0) as likes_count,
+                           COALESCE(c.dislikes, 0) as dislikes_count,
+                           ts_rank(to_tsvector('simple', p.content), query) as rank
+                    FROM posts p
+                    JOIN users u ON u.login = p.author
+                    LEFT JOIN post_reaction_counts c ON c.post_id = p.id,
+                    plainto_tsquery('simple', $1) query
+                    WHERE to_tsvector('simple', p.content) @@ query
+                      AND (u.is_public = true OR p.author = $2)
+                      AND ($3 = '' OR EXISTS (
+                          SELECT 1 FROM tags t WHERE t.id_post = p.id AND t.tag = $3))
+                      AND (ts_rank(to_tsvector('simple', p.content), query), p.id_uuid)
+                          < ($4::real, $5::uuid)
+                    ORDER BY rank DESC, p.id_uuid DESC
+                    LIMIT $6::integer
+                )sql",
+                q, *loginOpt, tag, cursorKey, cursorUuid, std::to_string(limit)
+            );
+        } else {
+            results = co_await scatterSql(
+                clients,
+                R"sql(
+                    SELECT p.id_uuid, p.version, p.content, p.author,
+                           epoch_us(p.created_at) as created_at_us,
+                           (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+                           (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+                           COALESCE(c.likes, 0) as likes_count,
+                           COALESCE(c.dislikes, 0) as dislikes_count
+                    FROM posts p
+                    JOIN users u ON u.login = p.author
+                    LEFT JOIN post_reaction_counts c ON c.post_id = p.id
+                    WHERE p.id IN (SELECT id_post FROM tags WHERE tag = $1)
+                      AND (u.is_public = true OR p.author = $2)
+                      AND (p.created_at, p.id_uuid) < (from_epoch_us($3::bigint), $4::uuid)
+                    ORDER BY p.created_at DESC, p.id_uuid DESC
+                    LIMIT $5::integer
+                )sql",
+                tag, *loginOpt, cursorKey, cursorUuid, std::to_string(limit)
             );
         }
-    );
+    } catch (const drogon::orm::DrogonDbException &e) {
+        --inFlight;
+        co_return dbError(e);
+    }
+    --inFlight;
+
+    RequestArena arena("search");
+    auto rows = ranked ? mergeShardRows(results, higherRank, 0, limit)
+                       : mergeShardRows(results, newerPost, 0, limit);
+    std::optional<std::string> nextCursor;
+    if (limit > 0 && rows.size() == static_cast<size_t>(limit)) {
+        const auto &last = rows.back();
+        nextCursor =
+            last[ranked ? "rank" : "created_at_us"].as<std::string>() + "_" +
+            last["id_uuid"].as<std::string>();
+    }
+    if (wantsCbor(req)) {
+        CborWriter out;
+        out.map(nextCursor ? 2 : 1);
+        out.text("posts");
+        out.array(rows.size());
+        for (const auto &row : rows) {
+            writePostCbor(out, row);
+        }
+        if (nextCursor) {
+            out.text("nextCursor");
+            out.text(*nextCursor);
+        }
+        co_return cborResponse(out.release());
+    }
+    std::string body = "{";
+    if (nextCursor) {
+        body += "\"nextCursor\":";
+        body += Json::valueToQuotedString(nextCursor->c_str());
+        body += ',';
+    }
+    body += "\"posts\":";
+    body += postsJsonArray(rows);
+    body += '}';
+    co_return negotiatedJsonResponse(std::move(body));
 }
 
-void PostsController::newsFeed(const HttpRequestPtr &req, Callback &&callback) {
-    verifyToken(req, [callback, req](std::optional<std::string> loginOpt) {
-        if (!loginOpt) {
-            sendUnauthorized(callback);
-            return;
+Task<HttpResponsePtr> PostsController::batchPosts(HttpRequestPtr req) {
+    static const int maxIds =
+        app().getCustomConfig()["batch"].get("max_ids", 100).asInt();
+
+    auto loginOpt = co_await verifyToken(req);
+    if (!loginOpt) {
+        co_return unauthorized();
+    }
+
+    auto json = req->getJsonObject();
+    if (!json || !(*json)["ids"].isArray()) {
+        co_return badRequest("ids are incorrect");
+    }
+    const Json::Value &ids = (*json)["ids"];
+    if (ids.size() > static_cast<Json::ArrayIndex>(maxIds)) {
+        co_return badRequest("Too many ids");
+    }
+
+    // Невалидные uuid в запрос не попадают и сразу помечаются как
+    // ненайденные.
+    std::vector<std::string> requested;
+    requested.reserve(ids.size());
+    std::unordered_set<std::string> unique;
+    std::string uuids = "{";
+    for (const auto &id : ids) {
+        requested.push_back(id.isString() ? id.asString() : "");
+        auto &uuid = requested.back();
+        // Postgres возвращает uuid в нижнем регистре.
+        asciiToLower(uuid);
+        if (validateUuid(uuid) && unique.insert(uuid).second) {
+            if (uuids.size() > 1) {
+                uuids += ',';
+            }
+            uuids += uuid;
         }
-        auto [lim, off] = parseLimitOffset(req);
-        int limit = lim, offset = off;
+    }
+    uuids += '}';
 
-        if (limit < 0 || offset < 0) {
-            sendBadRequest("limit or offset is incorrect", callback);
-            return;
+    // Запрос уходит только на шарды, номера которых есть в uuid, и на все
+    // шарды, если среди id есть созданные до шардирования.
+    auto &router = ShardRouter::instance();
+    auto readers = router.readers(*loginOpt);
+    std::vector<bool> targeted(router.count(), false);
+    for (const auto &uuid : unique) {
+        auto shard = router.shardOfPost(uuid);
+        if (!shard) {
+            targeted.assign(router.count(), true);
+            break;
+        }
+        targeted[*shard] = true;
+    }
+    std::vector<TimedDbClientPtr> clients;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (targeted[i]) {
+            clients.push_back(readers[i]);
         }
+    }
 
-        // потом здесь надо сделать проверку на друзей, пока что лента состоит
-        // только из постов пользователей с публичным аккаунтом
-        auto db = getDbClient();
-        db->execSqlAsync(
-            R"sql(
-                SELECT p.id_uuid, p.content, p.author, p.created_at,
-                       (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1, 
-                       (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images
-                FROM posts p
-                JOIN users u ON u.login = p.author
-                WHERE u.is_public = true
-                ORDER BY p.created_at DESC
-                LIMIT $1 OFFSET $2
-            )sql",
-            sendPostsResponse(callback), sendDbErrorResponse(callback),
-            std::to_string(limit), std::to_string(offset)
-        );
-    });
+    std::unordered_map<std::string, drogon::orm::Row> found;
+    if (!unique.empty()) {
+        try {
+            auto results = co_await scatterSql(
+                clients,
+                R"sql(
+                    SELECT p.id_uuid, p.legacy_uuid, p.version, p.content, p.author,
+                           epoch_us(p.created_at) as created_at_us,
+                           (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+                           (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images,
+                           COALESCE(c.likes, 0) as likes_count,
+                           COALESCE(c.dislikes, 0) as dislikes_count
+                    FROM posts p
+                    JOIN users u ON u.login = p.author
+                    LEFT JOIN post_reaction_counts c ON c.post_id = p.id
+                    WHERE (p.id_uuid = ANY($1::uuid[])
+                           OR p.legacy_uuid = ANY($1::uuid[]))
+                      AND (u.is_public = true OR p.author = $2)
+                )sql",
+                std::move(uuids), *loginOpt
+            );
+            // Пост, запрошенный по прежнему id, отдается на месте этого id.
+            for (const auto &r : results) {
+                for (const auto &row : r) {
+                    found.emplace(row["id_uuid"].as<std::string>(), row);
+                    if (!row["legacy_uuid"].isNull()) {
+                        found.emplace(row["legacy_uuid"].as<std::string>(), row);
+                    }
+                }
+            }
+        } catch (const drogon::orm::DrogonDbException &e) {
+            co_return dbError(e);
+        }
+    }
+
+    RequestArena arena("batch");
+    if (wantsCbor(req)) {
+        CborWriter out;
+        out.map(1);
+        out.text("posts");
+        out.array(requested.size());
+        for (const auto &uuid : requested) {
+            auto it = found.find(uuid);
+            if (it == found.end()) {
+                out.map(2);
+                out.text("id");
+                out.text(uuid);
+                out.text("notFound");
+                out.boolean(true);
+            } else {
+                writePostCbor(out, it->second);
+            }
+        }
+        co_return cborResponse(out.release());
+    }
+
+    std::string body = "{\"posts\":[";
+    for (size_t i = 0; i < requested.size(); ++i) {
+        if (i > 0) {
+            body += ',';
+        }
+        auto it = found.find(requested[i]);
+        if (it == found.end()) {
+            body += "{\"id\":";
+            body += Json::valueToQuotedString(requested[i].c_str());
+            body += ",\"notFound\":true}";
+        } else {
+            appendPostJson(body, it->second);
+        }
+    }
+    body += "]}";
+    co_return negotiatedJsonResponse(std::move(body));
 }
\ No newline at end of file
@@ -1,27 +1,36 @@
 #pragma once
 
 #include <drogon/HttpController.h>
+#include <drogon/utils/coroutine.h>
 
 class PostsController : public drogon::HttpController<PostsController> {
 public:
     METHOD_LIST_BEGIN
         ADD_METHOD_TO(PostsController::newPost, "/api/posts/new", drogon::Post);
         ADD_METHOD_TO(PostsController::getPost, "/api/posts/{postId}", drogon::Get);
+        ADD_METHOD_TO(PostsController::batchPosts, "/api/posts/batch", drogon::Post);
         ADD_METHOD_TO(PostsController::myFeed, "/api/posts/feed/my", drogon::Get);
         ADD_METHOD_TO(PostsController::userFeed, "/api/posts/feed/{login}", drogon::Get);
         ADD_METHOD_TO(PostsController::newsFeed, "/api/posts/feed", drogon::Get);
+        ADD_METHOD_TO(PostsController::search, "/api/posts/search", drogon::Get);
+        ADD_METHOD_TO(PostsController::likePost, "/api/posts/{postId}/like", drogon::Post);
+        ADD_METHOD_TO(PostsController::dislikePost, "/api/posts/{postId}/dislike", drogon::Post);
+        ADD_METHOD_TO(PostsController::removeReaction, "/api/posts/{postId}/reaction", drogon::Delete);
     METHOD_LIST_END
 
-    void newPost(const drogon::HttpRequestPtr& req,
-                std::function<void(const drogon::HttpResponsePtr&)>&& callback);
-    void getPost(const drogon::HttpRequestPtr& req,
-                std::function<void(const drogon::HttpResponsePtr&)>&& callback,
+    drogon::Task<drogon::HttpResponsePtr> newPost(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> getPost(drogon::HttpRequestPtr req,
                 std::string postId);
-    void myFeed(const drogon::HttpRequestPtr& req,
-                std::function<void(const drogon::HttpResponsePtr&)>&& callback);
-    void userFeed(const drogon::HttpRequestPtr& req,
-                std::function<void(const drogon::HttpResponsePtr&)>&& callback,
+    drogon::Task<drogon::HttpResponsePtr> batchPosts(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> myFeed(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> userFeed(drogon::HttpRequestPtr req,
                 std::string login);
-    void newsFeed(const drogon::HttpRequestPtr& req,
-                std::function<void(const drogon::HttpResponsePtr&)>&& callback);
+    drogon::Task<drogon::HttpResponsePtr> newsFeed(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> search(drogon::HttpRequestPtr req);
+    drogon::Task<drogon::HttpResponsePtr> likePost(drogon::HttpRequestPtr req,
+                std::string postId);
+    drogon::Task<drogon::HttpResponsePtr> dislikePost(drogon::HttpRequestPtr req,
+                std::string postId);
+    drogon::Task<drogon::HttpResponsePtr> removeReaction(drogon::HttpRequestPtr req,
+                std::string postId);
 };
\ No newline at end of file
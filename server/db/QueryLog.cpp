@@ -0,0 +1,145 @@
+#include "QueryLog.h"
+#include <drogon/drogon.h>
+#include <trantor/utils/Date.h>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+QueryLog &QueryLog::instance() {
+    static QueryLog log;
+    return log;
+}
+
+void QueryLog::configure(const Json::Value &config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slowThresholdMs_ = config.get("threshold_ms", slowThresholdMs_).asDouble();
+    explainSampleRate_ =
+        config.get("explain_sample_rate", explainSampleRate_.load())
+            .asDouble();
+    explainCooldown_ = std::chrono::seconds(
+        config.get("explain_cooldown_sec", (Json::Int64)explainCooldown_.count())
+            .asInt64()
+    );
+    explainFile_ = config.get("explain_file", explainFile_).asString();
+    auto dir = std::filesystem::path(explainFile_).parent_path();
+    std::error_code ec;
+    if (!dir.empty() && !std::filesystem::create_directories(dir, ec) && ec) {
+        LOG_ERROR << "Failed to create " << dir.string() << ": "
+                  << ec.message();
+    }
+    LOG_INFO << "slow query threshold " << slowThresholdMs_
+             << "ms, explain sample rate " << explainSampleRate_.load();
+}
+
+bool QueryLog::isExplainable(const std::string &sql) const {
+    auto it = std::find_if(sql.begin(), sql.end(), [](unsigned char c) {
+        return !std::isspace(c);
+    });
+    std::string head;
+    for (; it != sql.end() && head.size() < 6; ++it) {
+        head.push_back(std::toupper(static_cast<unsigned char>(*it)));
+    }
+    return head == "SELECT";
+}
+
+bool QueryLog::record(
+    const std::string &sql,
+    double elapsedMs,
+    bool failed,
+    const std::vector<std::string> &redactedParams
+) {
+    bool slow;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &stat = stats_[sql];
+        if (stat.calls == 0) {
+            stat.sql = sql;
+        }
+        ++stat.calls;
+        stat.totalMs += elapsedMs;
+        stat.maxMs = std::max(stat.maxMs, elapsedMs);
+        if (failed) {
+            ++stat.errors;
+        }
+        slow = elapsedMs >= slowThresholdMs_;
+        if (slow) {
+            ++stat.slowCalls;
+        }
+    }
+    if (!slow) {
+        return false;
+    }
+
+    std::string params;
+    for (size_t i = 0; i < redactedParams.size(); ++i) {
+        params += " $" + std::to_string(i + 1) + "=" + redactedParams[i];
+    }
+    LOG_WARN << "slow query " << elapsedMs << "ms" << (failed ? " (failed)" : "")
+             << ":" << params << " | " << sql;
+
+    return !failed && isExplainable(sql) && shouldSampleExplain(sql);
+}
+
+bool QueryLog::shouldSampleExplain(const std::string &sql) {
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_real_distribution<> dis(0.0, 1.0);
+    if (dis(gen) >= explainSampleRate_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = lastExplain_.find(sql);
+    if (it != lastExplain_.end() && now - it->second < explainCooldown_) {
+        return false;
+    }
+    lastExplain_[sql] = now;
+    return true;
+}
+
+void QueryLog::explain(const std::string &sql, const ExplainRunner &run) {
+    run(
+        "EXPLAIN (ANALYZE, BUFFERS) " + sql,
+        [this, sql](const drogon::orm::Result &plan) { writePlan(sql, plan); },
+        [](const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << "EXPLAIN failed: " << e.base().what();
+        }
+    );
+}
+
+void QueryLog::writePlan(
+    const std::string &sql,
+    const drogon::orm::Result &plan
+) {
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    std::ofstream file(explainFile_, std::ios::app);
+    if (!file.is_open()) {
+        LOG_ERROR << "Failed to open file: " << explainFile_;
+        return;
+    }
+    file << "-- " << trantor::Date::now().toFormattedString(false) << "\n"
+         << sql << "\n";
+    for (const auto &row : plan) {
+        file << row[0].as<std::string>() << "\n";
+    }
+    file << "\n";
+}
+
+std::vector<QueryLog::Stat> QueryLog::top(size_t n) const {
+    std::vector<Stat> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result.reserve(stats_.size());
+        for (const auto &[sql, stat] : stats_) {
+            result.push_back(stat);
+        }
+    }
+    auto count = std::min(n, result.size());
+    std::partial_sort(
+        result.begin(), result.begin() + count, result.end(),
+        [](const Stat &a, const Stat &b) { return a.totalMs > b.totalMs; }
+    );
+    result.resize(count);
+    return result;
+}
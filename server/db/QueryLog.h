@@ -0,0 +1,69 @@
+#pragma once
+#include <drogon/orm/DbClient.h>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Статистика выполнения SQL: медленные запросы пишутся в лог, для части из
+// них в файл сохраняется план EXPLAIN (ANALYZE, BUFFERS).
+class QueryLog {
+public:
+    struct Stat {
+        std::string sql;
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        uint64_t slowCalls = 0;
+        double totalMs = 0;
+        double maxMs = 0;
+    };
+
+    using ExplainRunner = std::function<void(
+        const std::string &,
+        std::function<void(const drogon::orm::Result &)>,
+        std::function<void(const drogon::orm::DrogonDbException &)>
+    )>;
+
+    static QueryLog &instance();
+
+    void configure(const Json::Value &config);
+
+    // EXPLAIN ANALYZE выполняет запрос, поэтому планы снимаются только для
+    // чтения.
+    bool isExplainable(const std::string &sql) const;
+
+    // Возвращает true, если для запроса нужно снять план.
+    bool record(
+        const std::string &sql,
+        double elapsedMs,
+        bool failed,
+        const std::vector<std::string> &redactedParams
+    );
+
+    void explain(const std::string &sql, const ExplainRunner &run);
+
+    std::vector<Stat> top(size_t n) const;
+
+private:
+    QueryLog() = default;
+
+    bool shouldSampleExplain(const std::string &sql);
+    void writePlan(const std::string &sql, const drogon::orm::Result &plan);
+
+    double slowThresholdMs_ = 200;
+    // Читается без mutex_ до розыгрыша сэмпла.
+    std::atomic<double> explainSampleRate_{0.1};
+    std::chrono::seconds explainCooldown_{60};
+    std::string explainFile_ = "logs/slow_query_plans.log";
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Stat> stats_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point>
+        lastExplain_;
+    std::mutex fileMutex_;
+};
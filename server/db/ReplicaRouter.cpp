@@ -0,0 +1,161 @@
+#include "ReplicaRouter.h"
+#include <drogon/drogon.h>
+#include <sstream>
+#include "db/SingleFlight.h"
+
+std::vector<std::pair<std::string, std::string>>
+parseHostPorts(const char *list) {
+    std::vector<std::pair<std::string, std::string>> result;
+    if (!list) {
+        return result;
+    }
+    std::istringstream iss(list);
+    std::string hostPort;
+    while (std::getline(iss, hostPort, ',')) {
+        if (hostPort.empty()) {
+            continue;
+        }
+        auto sep = hostPort.rfind(':');
+        result.emplace_back(
+            hostPort.substr(0, sep),
+            sep == std::string::npos ? "5432" : hostPort.substr(sep + 1)
+        );
+    }
+    return result;
+}
+
+// Параметры, указанные позже в строке подключения, переопределяют
+// host и port из базовой строки.
+std::string withHostPort(
+    const std::string &connectionString,
+    const std::string &host,
+    const std::string &port
+) {
+    return connectionString + " host=" + host + " port=" + port;
+}
+
+ReplicaRouter::ReplicaRouter(
+    const Json::Value &config,
+    const std::string &baseConnectionString,
+    TimedDbClientPtr primary,
+    const char *replicaHosts
+)
+    : primary_(std::move(primary)) {
+    maxLagSec_ = config.get("max_lag_sec", maxLagSec_).asDouble();
+    lagCheckIntervalSec_ =
+        config.get("lag_check_interval_sec", lagCheckIntervalSec_).asDouble();
+    rywWindow_ = std::chrono::milliseconds(static_cast<int64_t>(
+        config.get("ryw_window_sec", 10.0).asDouble() * 1000
+    ));
+
+    for (const auto &[host, port] : parseHostPorts(replicaHosts)) {
+        auto replica = std::make_unique<Replica>();
+        replica->name = host + ":" + port;
+        replica->client = std::make_shared<TimedDbClient>(
+            drogon::orm::DbClient::newPgClient(
+                withHostPort(baseConnectionString, host, port), 1
+            )
+        );
+        LOG_INFO << "read replica " << replica->name << " configured";
+        replicas_.push_back(std::move(replica));
+    }
+}
+
+void ReplicaRouter::start(trantor::EventLoop *loop) {
+    if (replicas_.empty()) {
+        return;
+    }
+    loop->runEvery(lagCheckIntervalSec_, [this]() { checkLag(); });
+}
+
+// Если реплика проиграла весь полученный WAL, она не отстает, даже если
+// последняя транзакция была давно, но только пока WAL receiver подключен
+// к primary: отключенная реплика проигрывает все, что успела получить, и
+// выглядела бы свежей. Реплика, не проигравшая еще ни одной транзакции,
+// отставание не знает и тоже пропускается. Без pg_read_all_stats status
+// в pg_stat_wal_receiver скрыт, тогда хватает наличия строки.
+void ReplicaRouter::checkLag() {
+    for (auto &replica : replicas_) {
+        auto *r = replica.get();
+        r->client->raw()->execSqlAsync(
+            R"sql(SELECT CASE
+                    WHEN pg_last_xact_replay_timestamp() IS NULL THEN NULL
+                    WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0
+                    ELSE EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp())
+                  END AS lag,
+                  EXISTS (SELECT 1 FROM pg_stat_wal_receiver
+                          WHERE status IS NULL OR status = 'streaming') AS streaming,
+                  pg_is_in_recovery() AS in_recovery)sql",
+            [this, r](const drogon::orm::Result &res) {
+                bool known = !res[0]["lag"].isNull();
+                double lag = known ? res[0]["lag"].as<double>() : -1;
+                bool healthy = res[0]["in_recovery"].as<bool>() &&
+                               res[0]["streaming"].as<bool>() && known &&
+                               lag <= maxLagSec_;
+                r->lagSec = lag;
+                if (r->healthy.exchange(healthy) != healthy) {
+                    LOG_WARN << "replica " << r->name
+                             << (healthy ? " is back" : " is skipped")
+                             << ", lag " << lag << "s";
+                }
+            },
+            [r](const drogon::orm::DrogonDbException &e) {
+                if (r->healthy.exchange(false)) {
+                    LOG_WARN << "replica " << r->name
+                             << " is skipped: " << e.base().what();
+                }
+            }
+        );
+    }
+}
+
+void ReplicaRouter::markWrite(const std::string &login) {
+    SingleFlight::instance().markWrite(login);
+    if (replicas_.empty()) {
+        return;
+    }
+    auto deadline = std::chrono::steady_clock::now() + rywWindow_;
+    std::lock_guard<std::mutex> lock(writersMutex_);
+    recentWriters_[login] = deadline;
+    if (recentWriters_.size() > 10000) {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = recentWriters_.begin(); it != recentWriters_.end();) {
+            it = it->second < now ? recentWriters_.erase(it) : std::next(it);
+        }
+    }
+}
+
+TimedDbClientPtr ReplicaRouter::reader(const std::string &login) {
+    if (replicas_.empty()) {
+        return primary_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writersMutex_);
+        auto it = recentWriters_.find(login);
+        if (it != recentWriters_.end()) {
+            if (it->second > std::chrono::steady_clock::now()) {
+                return primary_;
+            }
+            recentWriters_.erase(it);
+        }
+    }
+    for (size_t i = 0; i < replicas_.size(); ++i) {
+        auto &replica = replicas_[next_++ % replicas_.size()];
+        if (replica->healthy) {
+            return replica->client;
+        }
+    }
+    return primary_;
+}
+
+Json::Value ReplicaRouter::status() const {
+    Json::Value ret(Json::arrayValue);
+    for (const auto &replica : replicas_) {
+        Json::Value r;
+        r["name"] = replica->name;
+        r["lagSec"] = replica->lagSec.load();
+        r["healthy"] = replica->healthy.load();
+        ret.append(r);
+    }
+    return ret;
+}
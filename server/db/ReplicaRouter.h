@@ -0,0 +1,66 @@
+#pragma once
+#include <trantor/net/EventLoop.h>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "db/TimedDbClient.h"
+
+// "host:port,host:port" -> [(host, port)]; без порта подставляется 5432.
+std::vector<std::pair<std::string, std::string>>
+parseHostPorts(const char *list);
+
+std::string withHostPort(
+    const std::string &connectionString,
+    const std::string &host,
+    const std::string &port
+);
+
+// Чтения ленты и постов уходят на реплики шарда из списка
+// "host:port,host:port". Реплика с отставанием больше max_lag_sec
+// пропускается. Пользователь, который только что писал, в течение
+// ryw_window_sec читает с primary, чтобы видеть свои изменения.
+class ReplicaRouter {
+public:
+    ReplicaRouter(
+        const Json::Value &config,
+        const std::string &baseConnectionString,
+        TimedDbClientPtr primary,
+        const char *replicaHosts
+    );
+
+    void start(trantor::EventLoop *loop);
+
+    TimedDbClientPtr reader(const std::string &login);
+    void markWrite(const std::string &login);
+
+    Json::Value status() const;
+
+private:
+    struct Replica {
+        std::string name;
+        TimedDbClientPtr client;
+        // -1, если реплика еще ничего не проиграла.
+        std::atomic<double> lagSec{0};
+        std::atomic<bool> healthy{false};
+    };
+
+    void checkLag();
+
+    TimedDbClientPtr primary_;
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    std::atomic<size_t> next_{0};
+
+    double maxLagSec_ = 5;
+    double lagCheckIntervalSec_ = 1;
+    std::chrono::milliseconds rywWindow_{10000};
+
+    std::mutex writersMutex_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point>
+        recentWriters_;
+};
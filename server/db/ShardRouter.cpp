@@ -0,0 +1,144 @@
+#include "ShardRouter.h"
+#include "db/UuidV7.h"
+#include <drogon/drogon.h>
+#include <cstdlib>
+
+ShardRouter &ShardRouter::instance() {
+    static ShardRouter router;
+    return router;
+}
+
+std::vector<std::string> ShardRouter::resolveConnectionStrings(
+    const std::string &baseConnectionString
+) {
+    std::vector<std::string> connectionStrings;
+    for (const auto &[host, port] :
+         parseHostPorts(std::getenv("POSTGRES_SHARD_HOSTS"))) {
+        connectionStrings.push_back(
+            withHostPort(baseConnectionString, host, port)
+        );
+    }
+    if (connectionStrings.empty()) {
+        connectionStrings.push_back(baseConnectionString);
+    }
+    if (connectionStrings.size() > 256) {
+        LOG_FATAL << "at most 256 shards are supported";
+        connectionStrings.resize(256);
+    }
+    return connectionStrings;
+}
+
+void ShardRouter::configure(
+    const Json::Value &config,
+    const std::string &baseConnectionString,
+    bool replicaReads
+) {
+    auto connectionStrings = resolveConnectionStrings(baseConnectionString);
+
+    auto searchTimeoutMs =
+        config["search"].get("statement_timeout_ms", 500).asInt();
+    for (size_t i = 0; i < connectionStrings.size(); ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->index = i;
+        shard->connectionString = connectionStrings[i];
+        shard->primary = std::make_shared<TimedDbClient>(
+            drogon::orm::DbClient::newPgClient(connectionStrings[i], 1)
+        );
+        // Поиск идет через отдельное соединение с statement_timeout, чтобы
+        // тяжелый запрос не занимал соединение ленты.
+        shard->search = std::make_shared<TimedDbClient>(
+            drogon::orm::DbClient::newPgClient(
+                connectionStrings[i] + " options='-c statement_timeout=" +
+                    std::to_string(searchTimeoutMs) + "'",
+                1
+            )
+        );
+        std::string replicaEnv = connectionStrings.size() == 1
+                                     ? "POSTGRES_REPLICA_HOSTS"
+                                     : "POSTGRES_SHARD" + std::to_string(i) +
+                                           "_REPLICA_HOSTS";
+        const char *replicaHosts = std::getenv(replicaEnv.c_str());
+        if (replicaHosts && !replicaReads) {
+            LOG_WARN << replicaEnv << " is ignored: replica reads are disabled";
+            replicaHosts = nullptr;
+        }
+        shard->replicas = std::make_unique<ReplicaRouter>(
+            config["replicas"], connectionStrings[i], shard->primary,
+            replicaHosts
+        );
+        shards_.push_back(std::move(shard));
+    }
+    LOG_INFO << shards_.size() << " database shard(s) configured";
+}
+
+void ShardRouter::start(trantor::EventLoop *loop) {
+    for (auto &shard : shards_) {
+        shard->replicas->start(loop);
+    }
+}
+
+// FNV-1a: std::hash не гарантирует одинаковый результат между сборками.
+size_t ShardRouter::shardOf(const std::string &login, size_t count) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : login) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash % count;
+}
+
+std::optional<size_t> ShardRouter::shardTag(const std::string &uuid) {
+    // Метке верим только в UUIDv7: хвост старых UUIDv4 случайный и в одном
+    // случае из 256 совпадает с меткой чужого шарда.
+    if (uuid.size() != 36 || uuid[14] != '7' || uuid[32] != 'f' ||
+        uuid[33] != 'd') {
+        return std::nullopt;
+    }
+    return std::strtoul(uuid.substr(34).c_str(), nullptr, 16);
+}
+
+std::optional<size_t> ShardRouter::shardOfPost(const std::string &uuid) const {
+    auto shard = shardTag(uuid);
+    if (!shard || *shard >= shards_.size()) {
+        return std::nullopt;
+    }
+    return shard;
+}
+
+// UUIDv7, у которого последние два байта — 0xfd и номер шарда.
+std::string ShardRouter::newPostUuid(size_t shard) const {
+    return newUuidV7(static_cast<uint16_t>(0xfd00 | (shard & 0xff)));
+}
+
+std::vector<TimedDbClientPtr> ShardRouter::primaries() const {
+    std::vector<TimedDbClientPtr> clients;
+    for (const auto &shard : shards_) {
+        clients.push_back(shard->primary);
+    }
+    return clients;
+}
+
+std::vector<TimedDbClientPtr>
+ShardRouter::readers(const std::string &login) const {
+    std::vector<TimedDbClientPtr> clients;
+    for (const auto &shard : shards_) {
+        clients.push_back(shard->replicas->reader(login));
+    }
+    return clients;
+}
+
+std::vector<TimedDbClientPtr> ShardRouter::searchClients() const {
+    std::vector<TimedDbClientPtr> clients;
+    for (const auto &shard : shards_) {
+        clients.push_back(shard->search);
+    }
+    return clients;
+}
+
+std::vector<std::string> ShardRouter::connectionStrings() const {
+    std::vector<std::string> strings;
+    for (const auto &shard : shards_) {
+        strings.push_back(shard->connectionString);
+    }
+    return strings;
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <drogon/orm/DbClient.h>
+#include <trantor/net/EventLoop.h>
+#include <json/json.h>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "db/ReplicaRouter.h"
+#include "db/TimedDbClient.h"
+
+// Пользователь, его посты, теги, медиа и реакции на его посты живут на
+// шарде hash(login) % N, поэтому JOIN постов с users остается локальным.
+// Шарды задаются в POSTGRES_SHARD_HOSTS ("host:port,host:port"); без нее
+// используется единственный шард из POSTGRES_HOST/POSTGRES_PORT.
+// Изменение числа шардов требует переноса данных.
+class ShardRouter {
+public:
+    struct Shard {
+        size_t index;
+        std::string connectionString;
+        TimedDbClientPtr primary;
+        TimedDbClientPtr search;
+        std::unique_ptr<ReplicaRouter> replicas;
+    };
+
+    static ShardRouter &instance();
+
+    // Без replicaReads реплики не подключаются и все чтения идут в
+    // primary.
+    void configure(
+        const Json::Value &config,
+        const std::string &baseConnectionString,
+        bool replicaReads = true
+    );
+    void start(trantor::EventLoop *loop);
+
+    size_t count() const {
+        return shards_.size();
+    }
+
+    Shard &shard(size_t index) {
+        return *shards_[index];
+    }
+
+    Shard &forLogin(const std::string &login) {
+        return *shards_[shardOf(login)];
+    }
+
+    size_t shardOf(const std::string &login) const {
+        return shardOf(login, shards_.size());
+    }
+
+    // То же без настроенных клиентов, для CLI-режима drogon_app.
+    static std::vector<std::string>
+    resolveConnectionStrings(const std::string &baseConnectionString);
+    static size_t shardOf(const std::string &login, size_t count);
+    static std::optional<size_t> shardTag(const std::string &uuid);
+
+    // Номер шарда зашит в последние символы id_uuid поста. У постов со
+    // старыми UUIDv4 он не учитывается, такие посты ищутся на всех шардах.
+    std::optional<size_t> shardOfPost(const std::string &uuid) const;
+    std::string newPostUuid(size_t shard) const;
+
+    std::vector<TimedDbClientPtr> primaries() const;
+    std::vector<TimedDbClientPtr> readers(const std::string &login) const;
+    std::vector<TimedDbClientPtr> searchClients() const;
+    std::vector<std::string> connectionStrings() const;
+
+private:
+    ShardRouter() = default;
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// Выполняет один и тот же запрос на нескольких шардах параллельно.
+// Результаты возвращаются в порядке clients; ошибка любого шарда
+// пробрасывается наружу.
+template <typename... Arguments>
+class ScatterAwaiter {
+public:
+    ScatterAwaiter(
+        std::vector<TimedDbClientPtr> clients,
+        std::string sql,
+        Arguments... args
+    )
+        : clients_(std::move(clients)),
+          sql_(std::move(sql)),
+          args_(std::move(args)...) {
+    }
+
+    bool await_ready() const noexcept {
+        return clients_.empty();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        state_ = std::make_shared<State>(clients_.size(), handle);
+        for (size_t i = 0; i < clients_.size(); ++i) {
+            std::apply(
+                [&](const auto &...a) {
+                    clients_[i]->execSqlAsync(
+                        sql_,
+                        [state = state_, i](const drogon::orm::Result &r) {
+                            state->results[i] = r;
+                            state->finish();
+                        },
+                        [state = state_](const drogon::orm::DrogonDbException &e
+                        ) {
+                            state->fail(std::make_exception_ptr(e));
+                        },
+                        a...
+                    );
+                },
+                args_
+            );
+        }
+    }
+
+    std::vector<drogon::orm::Result> await_resume() {
+        std::vector<drogon::orm::Result> results;
+        if (!state_) {
+            return results;
+        }
+        if (state_->error) {
+            std::rethrow_exception(state_->error);
+        }
+        results.reserve(state_->results.size());
+        for (auto &r : state_->results) {
+            results.push_back(std::move(*r));
+        }
+        return results;
+    }
+
+private:
+    struct State {
+        State(size_t n, std::coroutine_handle<> h)
+            : results(n), remaining(n), handle(h) {
+        }
+
+        void finish() {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                handle.resume();
+            }
+        }
+
+        void fail(std::exception_ptr e) {
+            if (!failed.exchange(true)) {
+                error = std::move(e);
+            }
+            finish();
+        }
+
+        std::vector<std::optional<drogon::orm::Result>> results;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::coroutine_handle<> handle;
+    };
+
+    std::vector<TimedDbClientPtr> clients_;
+    std::string sql_;
+    std::tuple<Arguments...> args_;
+    std::shared_ptr<State> state_;
+};
+
+template <typename... Arguments>
+ScatterAwaiter<std::decay_t<Arguments>...> scatterSql(
+    std::vector<TimedDbClientPtr> clients,
+    std::string sql,
+    Arguments &&...args
+) {
+    return ScatterAwaiter<std::decay_t<Arguments>...>(
+        std::move(clients), std::move(sql), std::forward<Arguments>(args)...
+    );
+}
@@ -0,0 +1,85 @@
+#include "SingleFlight.h"
+
+SingleFlight &SingleFlight::instance() {
+    static SingleFlight singleFlight;
+    return singleFlight;
+}
+
+void SingleFlight::configure(const Json::Value &config) {
+    enabled_ = config.get("enabled", enabled_).asBool();
+    maxWaiters_ =
+        config.get("max_waiters", (Json::UInt64)maxWaiters_).asUInt64();
+}
+
+void SingleFlight::markWrite(const std::string &login) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(writesMutex_);
+    lastWrites_[login] = now;
+    // Запись важна, только пока идут начатые до нее запросы.
+    if (lastWrites_.size() > 10000) {
+        std::erase_if(lastWrites_, [&](const auto &item) {
+            return now - item.second > std::chrono::minutes(1);
+        });
+    }
+}
+
+std::optional<SingleFlight::Clock::time_point>
+SingleFlight::lastWrite(const std::string &login) {
+    std::lock_guard<std::mutex> lock(writesMutex_);
+    auto it = lastWrites_.find(login);
+    if (it == lastWrites_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void SingleFlight::finish(
+    const std::string &key,
+    const std::shared_ptr<Flight> &flight,
+    std::optional<drogon::orm::Result> result,
+    std::exception_ptr error
+) {
+    std::vector<std::pair<std::coroutine_handle<>, trantor::EventLoop *>>
+        waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Ключ мог уже перейти к более новому запросу.
+        auto it = flights_.find(key);
+        if (it != flights_.end() && it->second == flight) {
+            flights_.erase(it);
+        }
+        flight->result = std::move(result);
+        flight->error = std::move(error);
+        flight->done = true;
+        waiters.swap(flight->waiters);
+    }
+    if (flight->error && flight->joined > 0) {
+        sharedErrors_ += flight->joined;
+    }
+    // Ответы ожидающих собираются в их потоках, а не по очереди в потоке
+    // клиента базы.
+    for (auto &[handle, loop] : waiters) {
+        if (loop) {
+            loop->queueInLoop([handle]() { handle.resume(); });
+        } else {
+            handle.resume();
+        }
+    }
+}
+
+Json::Value SingleFlight::stats() const {
+    Json::Value ret;
+    ret["enabled"] = enabled_;
+    ret["maxWaiters"] = (Json::UInt64)maxWaiters_;
+    ret["executed"] = (Json::UInt64)executed_;
+    ret["coalesced"] = (Json::UInt64)coalesced_;
+    ret["overflow"] = (Json::UInt64)overflow_;
+    ret["afterWrite"] = (Json::UInt64)afterWrite_;
+    ret["sharedErrors"] = (Json::UInt64)sharedErrors_;
+    ret["maxJoined"] = (Json::UInt64)maxJoined_;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ret["inFlight"] = (Json::UInt64)flights_.size();
+    }
+    return ret;
+}
\ No newline at end of file
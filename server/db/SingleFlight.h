@@ -0,0 +1,171 @@
+#pragma once
+#include <drogon/orm/DbClient.h>
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Склейка одинаковых одновременных чтений: пока запрос с ключом key
+// выполняется, такие же запросы не идут в базу, а ждут его Result (или
+// исключение). Ключ строит TimedDbClient::execSqlShared из клиента, текста
+// запроса и параметров, поэтому чтение с primary и с реплики не
+// склеиваются. Ожидающие продолжают работу в своих event loop'ах.
+//
+// Читатель присоединяется только к запросу, начатому после его последней
+// записи (markWrite): иначе он получил бы результат без своих изменений.
+// Такой читатель, как и пришедший к запросу, у которого уже max_waiters
+// ожидающих, начинает новый запрос, и следующие читатели присоединяются
+// уже к нему.
+class SingleFlight {
+public:
+    static SingleFlight &instance();
+
+    void configure(const Json::Value &config);
+
+    template <typename Query>
+    drogon::Task<drogon::orm::Result>
+    run(std::string key, Query query, std::string reader);
+
+    // Вызывается после записи пользователя login, см.
+    // ReplicaRouter::markWrite.
+    void markWrite(const std::string &login);
+
+    Json::Value stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Flight {
+        Clock::time_point started = Clock::now();
+        bool done = false;
+        size_t joined = 0;
+        std::optional<drogon::orm::Result> result;
+        std::exception_ptr error;
+        std::vector<std::pair<std::coroutine_handle<>, trantor::EventLoop *>>
+            waiters;
+    };
+
+    class JoinAwaiter {
+    public:
+        JoinAwaiter(SingleFlight &owner, std::shared_ptr<Flight> flight)
+            : owner_(owner), flight_(std::move(flight)) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(owner_.mutex_);
+            if (flight_->done) {
+                return false;
+            }
+            flight_->waiters.emplace_back(
+                handle, trantor::EventLoop::getEventLoopOfCurrentThread()
+            );
+            return true;
+        }
+
+        drogon::orm::Result await_resume() {
+            if (flight_->error) {
+                std::rethrow_exception(flight_->error);
+            }
+            return *flight_->result;
+        }
+
+    private:
+        SingleFlight &owner_;
+        std::shared_ptr<Flight> flight_;
+    };
+
+    SingleFlight() = default;
+
+    std::optional<Clock::time_point> lastWrite(const std::string &login);
+
+    void finish(
+        const std::string &key,
+        const std::shared_ptr<Flight> &flight,
+        std::optional<drogon::orm::Result> result,
+        std::exception_ptr error
+    );
+
+    bool enabled_ = true;
+    size_t maxWaiters_ = 256;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+
+    std::mutex writesMutex_;
+    std::unordered_map<std::string, Clock::time_point> lastWrites_;
+
+    std::atomic<uint64_t> executed_{0};
+    std::atomic<uint64_t> coalesced_{0};
+    std::atomic<uint64_t> overflow_{0};
+    std::atomic<uint64_t> afterWrite_{0};
+    std::atomic<uint64_t> sharedErrors_{0};
+    std::atomic<size_t> maxJoined_{0};
+};
+
+template <typename Query>
+drogon::Task<drogon::orm::Result>
+SingleFlight::run(std::string key, Query query, std::string reader) {
+    if (!enabled_) {
+        co_return co_await query();
+    }
+    auto written = lastWrite(reader);
+    std::shared_ptr<Flight> flight;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &current = flights_[key];
+        if (!current) {
+            leader = true;
+        } else if (written && current->started <= *written) {
+            ++afterWrite_;
+            leader = true;
+        } else if (current->joined >= maxWaiters_) {
+            ++overflow_;
+            leader = true;
+        }
+        if (leader) {
+            // Прежний запрос доработает сам, его ожидающие дождутся его.
+            current = std::make_shared<Flight>();
+            flight = current;
+        } else {
+            flight = current;
+            size_t joined = ++flight->joined;
+            if (joined > maxJoined_.load(std::memory_order_relaxed)) {
+                maxJoined_.store(joined, std::memory_order_relaxed);
+            }
+        }
+    }
+    if (!leader) {
+        ++coalesced_;
+        co_return co_await JoinAwaiter(*this, std::move(flight));
+    }
+
+    ++executed_;
+    std::optional<drogon::orm::Result> result;
+    std::exception_ptr error;
+    try {
+        result = co_await query();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    finish(key, flight, result, error);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    co_return std::move(*result);
+}
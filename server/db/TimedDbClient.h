@@ -0,0 +1,207 @@
+#pragma once
+#include <drogon/orm/DbClient.h>
+#include <drogon/utils/coroutine.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "db/QueryLog.h"
+#include "db/SingleFlight.h"
+
+// В лог медленных запросов значения параметров не попадают, только их тип
+// и длина.
+template <typename T>
+inline std::string redactParam(const T &value) {
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, bool>) {
+        return "<bool>";
+    } else if constexpr (std::is_arithmetic_v<U>) {
+        return "<number>";
+    } else if constexpr (std::is_convertible_v<const U &, std::string_view>) {
+        return "<text len=" +
+               std::to_string(std::string_view(value).size()) + ">";
+    } else {
+        return "<value>";
+    }
+}
+
+template <typename T>
+inline std::string redactParam(const std::optional<T> &value) {
+    return value ? redactParam(*value) : "<null>";
+}
+
+// Часть ключа SingleFlight: тип и значение параметра с длиной, чтобы
+// разные наборы параметров не давали одинаковую строку.
+template <typename T>
+inline void appendFlightKey(std::string &key, const T &value) {
+    using U = std::decay_t<T>;
+    std::string_view text;
+    std::string number;
+    if constexpr (std::is_same_v<U, bool>) {
+        key += value ? "|b1" : "|b0";
+        return;
+    } else if constexpr (std::is_arithmetic_v<U>) {
+        number = std::to_string(value);
+        text = number;
+        key += "|n";
+    } else {
+        text = value;
+        key += "|s";
+    }
+    key += std::to_string(text.size());
+    key += ':';
+    key += text;
+}
+
+template <typename T>
+inline void appendFlightKey(std::string &key, const std::optional<T> &value) {
+    if (value) {
+        appendFlightKey(key, *value);
+    } else {
+        key += "|-";
+    }
+}
+
+// Обертка над DbClient, через которую контроллеры выполняют все запросы:
+// каждый запрос замеряется и попадает в QueryLog.
+class TimedDbClient {
+public:
+    explicit TimedDbClient(drogon::orm::DbClientPtr client)
+        : client_(std::move(client)) {
+    }
+
+    const drogon::orm::DbClientPtr &raw() const {
+        return client_;
+    }
+
+    // Аргументы живут в кадре корутины, как в execSqlCoro, и копируются для
+    // EXPLAIN только после того, как запрос оказался медленным.
+    template <typename FUNCTION1, typename FUNCTION2, typename... Arguments>
+    void execSqlAsync(
+        const std::string &sql,
+        FUNCTION1 &&rCallback,
+        FUNCTION2 &&exceptCallback,
+        Arguments &&...args
+    ) {
+        runAsync(
+            client_, sql, std::forward<FUNCTION1>(rCallback),
+            std::forward<FUNCTION2>(exceptCallback),
+            std::forward<Arguments>(args)...
+        );
+    }
+
+    // Параметры принимаются по значению: они живут в кадре корутины, пока
+    // запрос не завершится.
+    template <typename... Arguments>
+    drogon::Task<drogon::orm::Result>
+    execSqlCoro(std::string sql, Arguments... args) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> params{redactParam(args)...};
+        try {
+            auto r = co_await client_->execSqlCoro(sql, args...);
+            if (QueryLog::instance().record(
+                    sql, elapsedMs(start), false, params
+                ) &&
+                QueryLog::instance().isExplainable(sql)) {
+                explain(
+                    client_, sql,
+                    std::make_shared<std::tuple<Arguments...>>(
+                        std::move(args)...
+                    )
+                );
+            }
+            co_return r;
+        } catch (const drogon::orm::DrogonDbException &) {
+            QueryLog::instance().record(sql, elapsedMs(start), true, params);
+            throw;
+        }
+    }
+
+    // Чтение, которое можно разделить с такими же одновременными
+    // запросами через этот клиент, см. SingleFlight. Только для SELECT без
+    // побочных эффектов. reader — логин читающего: к запросу, начатому до
+    // его последней записи, он не присоединяется.
+    template <typename... Arguments>
+    drogon::Task<drogon::orm::Result>
+    execSqlShared(std::string reader, std::string sql, Arguments... args) {
+        std::string key = std::to_string(reinterpret_cast<uintptr_t>(this));
+        key += '|';
+        key += sql;
+        (appendFlightKey(key, args), ...);
+        co_return co_await SingleFlight::instance().run(
+            std::move(key),
+            [&]() { return execSqlCoro(std::move(sql), std::move(args)...); },
+            std::move(reader)
+        );
+    }
+
+private:
+    template <typename FUNCTION1, typename FUNCTION2, typename... Arguments>
+    static drogon::AsyncTask runAsync(
+        drogon::orm::DbClientPtr client,
+        std::string sql,
+        FUNCTION1 rCallback,
+        FUNCTION2 exceptCallback,
+        Arguments... args
+    ) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> params{redactParam(args)...};
+        std::optional<drogon::orm::Result> r;
+        try {
+            r = co_await client->execSqlCoro(sql, args...);
+        } catch (const drogon::orm::DrogonDbException &e) {
+            QueryLog::instance().record(sql, elapsedMs(start), true, params);
+            exceptCallback(e);
+            co_return;
+        }
+        if (QueryLog::instance().record(sql, elapsedMs(start), false, params) &&
+            QueryLog::instance().isExplainable(sql)) {
+            explain(
+                client, sql,
+                std::make_shared<std::tuple<Arguments...>>(std::move(args)...)
+            );
+        }
+        rCallback(*r);
+    }
+
+    static double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start
+        )
+            .count();
+    }
+
+    template <typename Tuple>
+    static void explain(
+        const drogon::orm::DbClientPtr &client,
+        const std::string &sql,
+        std::shared_ptr<Tuple> saved
+    ) {
+        QueryLog::instance().explain(
+            sql,
+            [client, saved](
+                const std::string &explainSql, auto onPlan, auto onError
+            ) {
+                std::apply(
+                    [&](const auto &...a) {
+                        client->execSqlAsync(
+                            explainSql, std::move(onPlan), std::move(onError),
+                            a...
+                        );
+                    },
+                    *saved
+                );
+            }
+        );
+    }
+
+    drogon::orm::DbClientPtr client_;
+};
+
+using TimedDbClientPtr = std::shared_ptr<TimedDbClient>;
@@ -0,0 +1,87 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+// UUID версии 7 (RFC 9562): 48 бит времени в миллисекундах, затем версия,
+// 12-битный счетчик внутри миллисекунды и случайные биты. Значения одного
+// потока строго возрастают, между потоками упорядочены с точностью до
+// миллисекунды, поэтому вставки идут в правый край B-дерева, а сортировка
+// по id_uuid совпадает с сортировкой по времени. Последние 16 бит задает
+// вызывающий (метка шарда, см. ShardRouter::newPostUuid).
+inline std::string newUuidV7(uint16_t tail) {
+    struct State {
+        std::mt19937_64 gen{std::random_device{}()};
+        uint64_t lastMs = 0;
+        uint32_t counter = 0;
+    };
+    thread_local State state;
+
+    uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()
+    )
+                         .count();
+    uint64_t random = state.gen();
+    if (nowMs > state.lastMs) {
+        state.lastMs = nowMs;
+        // Старший бит счетчика нулевой, чтобы в миллисекунду гарантированно
+        // помещалось не меньше 2048 значений.
+        state.counter = random & 0x7ff;
+        random >>= 11;
+    } else if (++state.counter > 0xfff) {
+        // Счетчик исчерпан (или часы ушли назад): время берется взаймы у
+        // следующей миллисекунды, порядок не нарушается.
+        ++state.lastMs;
+        state.counter = random & 0x7ff;
+        random >>= 11;
+    }
+
+    uint64_t hi = (state.lastMs << 16) | 0x7000 | state.counter;
+    uint64_t lo = 0x8000000000000000ull |
+                  ((random & 0x3fffffffffffull) << 16) | tail;
+    // snprintf здесь занимал больше времени, чем вся генерация.
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string out(36, '-');
+    size_t pos = 0;
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        if (pos == 8 || pos == 13) {
+            ++pos;
+        }
+        out[pos++] = digits[(hi >> shift) & 0xf];
+    }
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        if (pos == 18 || pos == 23) {
+            ++pos;
+        }
+        out[pos++] = digits[(lo >> shift) & 0xf];
+    }
+    return out;
+}
+
+// Время создания из UUIDv7 в миллисекундах от эпохи; std::nullopt для
+// других версий.
+inline std::optional<int64_t> uuidV7Millis(std::string_view uuid) {
+    if (uuid.size() != 36 || uuid[8] != '-' || uuid[13] != '-' ||
+        uuid[14] != '7') {
+        return std::nullopt;
+    }
+    int64_t ms = 0;
+    for (size_t i = 0; i < 13; ++i) {
+        if (i == 8) {
+            continue;
+        }
+        char c = uuid[i];
+        int digit = c >= '0' && c <= '9'   ? c - '0'
+                    : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                    : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                           : -1;
+        if (digit < 0) {
+            return std::nullopt;
+        }
+        ms = ms * 16 + digit;
+    }
+    return ms;
+}
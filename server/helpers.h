@@ -9,24 +9,53 @@
 #include <string>
 #include <fstream>
 #include <filesystem>
+#include <memory_resource>
 #include <random>
+#include <vector>
 #include <chrono>
 #include <drogon/utils/Utilities.h>
+#include <drogon/utils/coroutine.h>
+#include "codec/Timestamp.h"
+#include "db/ShardRouter.h"
+#include "db/TimedDbClient.h"
+#include "services/AsyncLog.h"
+#include "services/RequestArena.h"
+#include "services/TokenCache.h"
+#include "services/Topology.h"
 
 using namespace drogon;
 
 using Callback = std::function<void(const HttpResponsePtr &)>;
 
-inline drogon::orm::DbClientPtr getDbClient() {
-    static drogon::orm::DbClientPtr client = drogon::orm::DbClient::newPgClient(
-        "host=" + std::string(std::getenv("POSTGRES_HOST")) +
-            " port=" + std::string(std::getenv("POSTGRES_PORT")) +
-            " dbname=" + std::string(std::getenv("POSTGRES_DATABASE")) +
-            " user=" + std::string(std::getenv("POSTGRES_USERNAME")) +
-            " password=" + std::string(std::getenv("POSTGRES_PASSWORD")),
-        1
-    );
-    return client;
+inline std::string pgConnectionString() {
+    return "host=" + std::string(std::getenv("POSTGRES_HOST")) +
+           " port=" + std::string(std::getenv("POSTGRES_PORT")) +
+           " dbname=" + std::string(std::getenv("POSTGRES_DATABASE")) +
+           " user=" + std::string(std::getenv("POSTGRES_USERNAME")) +
+           " password=" + std::string(std::getenv("POSTGRES_PASSWORD"));
+}
+
+// Primary шарда, на котором живет пользователь login и его посты.
+inline TimedDbClientPtr getDbClient(const std::string &login) {
+    return ShardRouter::instance().forLogin(login).primary;
+}
+
+// Чтение данных пользователя owner, которому допустимо небольшое
+// отставание. Сразу после записи reader читает с primary, см.
+// ReplicaRouter::markWrite.
+inline TimedDbClientPtr
+getReadDbClient(const std::string &owner, const std::string &reader) {
+    return ShardRouter::instance().forLogin(owner).replicas->reader(reader);
+}
+
+// Отладочные эндпоинты доступны только при заданном DEBUG_TOKEN и только с
+// заголовком X-Debug-Token.
+inline bool checkDebugAccess(const drogon::HttpRequestPtr &req) {
+    static const std::string debugToken = [] {
+        auto s = std::getenv("DEBUG_TOKEN");
+        return s ? s : "";
+    }();
+    return !debugToken.empty() && req->getHeader("X-Debug-Token") == debugToken;
 }
 
 inline std::string hashPassword(const std::string &plain) {
@@ -55,6 +84,19 @@ inline bool checkPassword(const std::string &plain, const std::string &hash) {
     return result && hash == result;
 }
 
+// Выполняет f в CPU-пуле Topology и возвращается в исходный loop, чтобы
+// bcrypt и декодирование картинок не останавливали IO loop.
+template <typename F>
+inline drogon::Task<std::invoke_result_t<F>> runOnCpuPool(F f) {
+    auto loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+    co_await drogon::switchThreadCoro(Topology::instance().cpuLoop());
+    auto result = f();
+    if (loop) {
+        co_await drogon::switchThreadCoro(loop);
+    }
+    co_return result;
+}
+
 inline std::string JWT_SECRET = [] {
     auto s = std::getenv("RANDOM_SECRET");
     return s ? s : "default_secret";
@@ -109,6 +151,59 @@ inline std::optional<TokenPayload> getTokenContent(const std::string &token) {
     }
 }
 
+inline drogon::Task<std::optional<std::string>>
+verifyBearerToken(std::string token) {
+    auto payload = getTokenContent(token);
+    if (!payload || payload->exp < std::chrono::system_clock::time_point()) {
+        AsyncLog::instance().event(
+            "auth", "token rejected", {{"reason", "invalid_or_expired"}}
+        );
+        co_return std::nullopt;
+    }
+    try {
+        auto dbTokenNumber = TokenCache::instance().get(payload->login);
+        if (!dbTokenNumber) {
+            auto r = co_await getDbClient(payload->login)->execSqlCoro(
+                R"sql(SELECT token_number FROM users WHERE login = $1)sql",
+                payload->login
+            );
+            if (r.empty()) {
+                AsyncLog::instance().event(
+                    "auth", "token rejected",
+                    {{"reason", "unknown_user"}, {"login", payload->login}}
+                );
+                co_return std::nullopt;
+            }
+            dbTokenNumber = r[0]["token_number"].as<int>();
+            TokenCache::instance().put(payload->login, *dbTokenNumber);
+        }
+        if (*dbTokenNumber != payload->token_number) {
+            AsyncLog::instance().event(
+                "auth", "token rejected",
+                {{"reason", "revoked"}, {"login", payload->login}}
+            );
+            co_return std::nullopt;
+        }
+    } catch (const drogon::orm::DrogonDbException &e) {
+        LOG_ERROR << e.base().what();
+        co_return std::nullopt;
+    }
+    co_return std::move(payload->login);
+}
+
+// req живет в кадре вызывающего обработчика, который сразу делает co_await.
+inline drogon::Task<std::optional<std::string>>
+verifyToken(const drogon::HttpRequestPtr &req) {
+    const auto &auth = req->getHeader("Authorization");
+    if (auth.size() < 7 || auth.compare(0, 7, "Bearer ") != 0) {
+        AsyncLog::instance().event(
+            "auth", "token rejected", {{"reason", "not_bearer"}}
+        );
+        co_return std::nullopt;
+    }
+    co_return co_await verifyBearerToken(auth.substr(7));
+}
+
 inline bool validateLogin(const std::string &login) {
     return !login.empty() && login.length() <= 30 &&
            std::regex_match(login, std::regex("^[a-zA-Z0-9-]+$"));
@@ -129,7 +224,7 @@ inline bool validatePasswordStrength(const std::string &pw) {
         return false;
     }
     bool upper = false, lower = false, digit = false;
-    for (char c : pw) {
+    for (unsigned char c : pw) {
         if (isupper(c)) {
             upper = true;
         } else if (islower(c)) {
@@ -146,45 +241,76 @@ inline bool validatePhone(const std::string &phone) {
            std::regex_match(phone, std::regex("^\\+[\\d]+$"));
 }
 
+inline bool validateUuid(const std::string &uuid) {
+    if (uuid.size() != 36) {
+        return false;
+    }
+    for (size_t i = 0; i < uuid.size(); ++i) {
+        bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        auto c = static_cast<unsigned char>(uuid[i]);
+        if (dash ? c != '-' : !isxdigit(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 inline bool validateImage(const std::string &image) {
     return image.length() <= 200;
 }
 
-inline std::string generateFilename(const std::string& extension = ".jpg") {
-    auto now = std::chrono::system_clock::now();
-    auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(100000, 999999);
-    return std::to_string(timestamp) + "_" + std::to_string(dis(gen)) + extension;
-}
-
-inline bool saveBase64(const std::string& base64Data, const std::string& filePath) {
-    LOG_INFO << "saveBase64 started";
-    std::string decoded = drogon::utils::base64Decode(base64Data);
-    LOG_INFO << "decoded Base64";
-    if (decoded.empty()) {
-        LOG_ERROR << "Failed to decode base64 image";
-        return false;
+// Обход списка, склеенного string_agg через запятую.
+template <typename F>
+inline void forEachListItem(const std::string &joined, F &&f) {
+    size_t begin = 0;
+    while (begin < joined.size()) {
+        size_t end = joined.find(',', begin);
+        if (end == std::string::npos) {
+            end = joined.size();
+        }
+        f(std::string_view(joined).substr(begin, end - begin));
+        begin = end + 1;
     }
-    std::ofstream file(filePath, std::ios::binary);
-    if (!file.is_open()) {
-        LOG_ERROR << "Failed to open file: " << filePath;
-        return false;
+}
+
+// Элемент литерала массива Postgres для параметра $n::text[]: значение в
+// кавычках, кавычки и обратные слэши экранируются.
+inline void appendPgArrayItem(std::string &array, std::string_view item) {
+    array += array.size() > 1 ? ",\"" : "\"";
+    for (char c : item) {
+        if (c == '"' || c == '\\') {
+            array += '\\';
+        }
+        array += c;
     }
-    file.write(decoded.data(), decoded.size());
-    file.close();
-    return true;
+    array += '"';
 }
 
-inline std::string loadImageAsBase64(const std::string& filePath) {
-    std::ifstream file(filePath, std::ios::binary);
+// Содержимое файла нужно только до кодирования в ответ. Оно читается в
+// обычную кучу, а не в арену запроса: арена ничего не освобождает до конца
+// обработчика, и страница ленты держала бы все картинки сразу.
+inline std::optional<std::vector<unsigned char>>
+readImage(const std::string &filePath) {
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         LOG_ERROR << "Failed to open image file: " << filePath;
+        return std::nullopt;
+    }
+    std::vector<unsigned char> content(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(content.data()), content.size());
+    return content;
+}
+
+inline std::string loadImageAsBase64(const std::string& filePath) {
+    auto content = readImage(filePath);
+    if (!content) {
         return "";
     }
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string content = buffer.str();
-    return drogon::utils::base64Encode(content);
+    return drogon::utils::base64Encode(content->data(), content->size());
+}
+
+// epoch_us(p.created_at) из строки результата без std::stoll.
+inline int64_t createdAtUs(const drogon::orm::Row &row) {
+    return parseEpochUs(row["created_at_us"].as<const char *>());
 }
\ No newline at end of file
@@ -1,20 +1,34 @@
 #include <drogon/drogon.h>
 #include <drogon/orm/DbClient.h>
 #include <drogon/orm/Exception.h>
+#include <trantor/utils/Logger.h>
+#include <cstdio>
 #include <cstdlib>
+#include <iostream>
 #include <string>
 #include "controllers/AuthController.h"
+#include "db/QueryLog.h"
+#include "db/ShardRouter.h"
+#include "db/SingleFlight.h"
 #include "helpers.h"
+#include "services/AdmissionControl.h"
+#include "services/AsyncLog.h"
+#include "services/AvailabilityFilter.h"
+#include "services/FeedHub.h"
+#include "services/IdempotencyStore.h"
+#include "services/MediaStore.h"
+#include "services/PostCache.h"
+#include "services/PostTransfer.h"
+#include "services/Profiler.h"
+#include "services/ReactionBuffer.h"
+#include "services/Supervisor.h"
+#include "services/TokenCache.h"
+#include "services/Topology.h"
+#include "services/Warmup.h"
 
 using namespace drogon;
 
-void setupDatabase() {
-    auto db = getDbClient();
-    if (!db) {
-        LOG_FATAL << "Cannot get database client!";
-        return;
-    }
-    LOG_INFO << "Database client obtained successfully";
+void setupDatabase(const TimedDbClientPtr &db) {
     db->execSqlAsync(
         R"sql(
         CREATE TABLE IF NOT EXISTS users (
@@ -34,6 +48,17 @@ void setupDatabase() {
         }
     );
 
+    // crypt() для проверки пароля при входе.
+    db->execSqlAsync(
+        R"sql(CREATE EXTENSION IF NOT EXISTS pgcrypto)sql",
+        [](const drogon::orm::Result &) {
+            LOG_INFO << "pgcrypto extension ready";
+        },
+        [](const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << e.base().what();
+        }
+    );
+
     db->execSqlAsync(
         R"sql(CREATE EXTENSION IF NOT EXISTS "uuid-ossp")sql",
         [](const drogon::orm::Result &) {
@@ -50,7 +75,7 @@ void setupDatabase() {
                  id_uuid UUID DEFAULT uuid_generate_v4(), 
                  content VARCHAR(1000) NOT NULL, 
                  author VARCHAR(30) NOT NULL, 
-                 created_at TIMESTAMP WITHOUT TIME ZONE))sql",
+                 created_at TIMESTAMPTZ))sql",
         [](const drogon::orm::Result &) { LOG_INFO << "posts table ready"; },
         [](const drogon::orm::DrogonDbException &e) {
             LOG_ERROR << e.base().what();
@@ -76,20 +101,396 @@ void setupDatabase() {
         [](const drogon::orm::Result &) { LOG_INFO << "media table ready"; },
         [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
     );
+
+    // Раньше created_at был TIMESTAMP WITHOUT TIME ZONE со временем UTC.
+    db->execSqlAsync(
+        R"sql(
+        DO $$
+        BEGIN
+            IF (SELECT data_type FROM information_schema.columns
+                WHERE table_name = 'posts' AND column_name = 'created_at')
+               = 'timestamp without time zone' THEN
+                ALTER TABLE posts ALTER COLUMN created_at TYPE TIMESTAMPTZ
+                    USING created_at AT TIME ZONE 'UTC';
+            END IF;
+        END $$)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    // Время передается между сервером и базой целым числом микросекунд от
+    // эпохи: без разбора и форматирования строк на каждой строке ленты.
+    db->execSqlAsync(
+        R"sql(
+        CREATE OR REPLACE FUNCTION epoch_us(ts TIMESTAMPTZ) RETURNS BIGINT
+        AS $$ SELECT (extract(epoch FROM ts) * 1000000)::BIGINT $$
+        LANGUAGE sql IMMUTABLE STRICT)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    // Максимальный BIGINT означает 'infinity' (начальный курсор поиска).
+    db->execSqlAsync(
+        R"sql(
+        CREATE OR REPLACE FUNCTION from_epoch_us(us BIGINT) RETURNS TIMESTAMPTZ
+        AS $$ SELECT CASE WHEN us = 9223372036854775807 THEN 'infinity'::TIMESTAMPTZ
+                          ELSE 'epoch'::TIMESTAMPTZ + us * INTERVAL '1 microsecond' END $$
+        LANGUAGE sql IMMUTABLE STRICT)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    // version увеличивается при каждом изменении поста, по нему
+    // инвалидируется PostCache.
+    db->execSqlAsync(
+        R"sql(ALTER TABLE posts ADD COLUMN IF NOT EXISTS version BIGINT NOT NULL DEFAULT 1)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    // Прежний id поста после перевода на UUIDv7, см. migratePostUuids.
+    db->execSqlAsync(
+        R"sql(ALTER TABLE posts ADD COLUMN IF NOT EXISTS legacy_uuid UUID)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE UNIQUE INDEX IF NOT EXISTS posts_id_uuid_idx ON posts (id_uuid))sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "posts_id_uuid_idx ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE INDEX IF NOT EXISTS posts_legacy_uuid_idx ON posts (legacy_uuid)
+              WHERE legacy_uuid IS NOT NULL)sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "posts_legacy_uuid_idx ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    // Картинки адресуются по SHA-256; у строк, созданных раньше, hash пустой.
+    db->execSqlAsync(
+        R"sql(ALTER TABLE media ADD COLUMN IF NOT EXISTS hash CHAR(64))sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE INDEX IF NOT EXISTS media_hash_idx ON media (hash))sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "media_hash_idx ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE INDEX IF NOT EXISTS posts_content_fts_idx
+              ON posts USING GIN (to_tsvector('simple', content)))sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "posts fts index ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE INDEX IF NOT EXISTS tags_tag_idx ON tags (tag, id_post))sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "tags tag index ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE INDEX IF NOT EXISTS tags_id_post_idx ON tags (id_post))sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "tags post index ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE TABLE IF NOT EXISTS idempotency_keys (
+            login VARCHAR(30) NOT NULL,
+            idem_key VARCHAR(255) NOT NULL,
+            fingerprint CHAR(64) NOT NULL,
+            response TEXT,
+            created_at TIMESTAMPTZ NOT NULL DEFAULT now(),
+            PRIMARY KEY (login, idem_key)))sql",
+        [](const drogon::orm::Result &) {
+            LOG_INFO << "idempotency_keys table ready";
+        },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE TABLE IF NOT EXISTS reactions (
+            post_id INTEGER REFERENCES posts(id) ON DELETE CASCADE,
+            login VARCHAR(30) NOT NULL,
+            value SMALLINT NOT NULL,
+            PRIMARY KEY (post_id, login)))sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "reactions table ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    // Значение до последнего изменения: из него ReactionBuffer считает
+    // приращения счетчиков.
+    db->execSqlAsync(
+        R"sql(ALTER TABLE reactions ADD COLUMN IF NOT EXISTS
+              prev_value SMALLINT NOT NULL DEFAULT 0)sql",
+        [](const drogon::orm::Result &) { LOG_INFO << "reactions.prev_value ready"; },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
+
+    db->execSqlAsync(
+        R"sql(CREATE TABLE IF NOT EXISTS post_reaction_counts (
+            post_id INTEGER PRIMARY KEY REFERENCES posts(id) ON DELETE CASCADE,
+            likes BIGINT NOT NULL DEFAULT 0,
+            dislikes BIGINT NOT NULL DEFAULT 0))sql",
+        [](const drogon::orm::Result &) {
+            LOG_INFO << "post_reaction_counts table ready";
+        },
+        [](const drogon::orm::DrogonDbException &e) { LOG_ERROR << e.base().what(); }
+    );
 }
 
-int main() {
+// Перевод постов со случайными UUIDv4 на UUIDv7 по created_at пачками по
+// batch строк. Прежний id остается в legacy_uuid, и ссылки на пост
+// продолжают работать. Хвост нового id — метка шарда, на котором пост
+// лежит: хвост старого UUIDv4 мог случайно начинаться с 0xfd и отправлять
+// поиск поста на чужой шард. version увеличивается, чтобы PostCache не
+// отдал фрагмент со старым id.
+void migratePostUuids(const TimedDbClientPtr &db, size_t shard, size_t batch) {
+    char tag[5];
+    std::snprintf(tag, sizeof(tag), "fd%02zx", shard & 0xff);
+    drogon::async_run([db, batch, tag = std::string(tag)]() -> drogon::Task<> {
+        // Посты, переведенные раньше с хвостом, похожим на метку чужого
+        // шарда, получают метку своего.
+        static const std::string remapSql = R"sql(
+            UPDATE posts SET
+                id_uuid = (left(replace(id_uuid::text, '-', ''), 28) || $1)::uuid,
+                version = version + 1
+            WHERE legacy_uuid IS NOT NULL
+              AND substr(id_uuid::text, 15, 1) = '7'
+              AND right(id_uuid::text, 4) LIKE 'fd%'
+              AND right(id_uuid::text, 4) <> $1
+        )sql";
+        static const std::string sql = R"sql(
+            WITH batch AS (
+                SELECT id FROM posts
+                WHERE legacy_uuid IS NULL AND created_at IS NOT NULL
+                  AND substr(id_uuid::text, 15, 1) <> '7'
+                LIMIT $1
+                FOR UPDATE SKIP LOCKED
+            )
+            UPDATE posts p SET
+                legacy_uuid = p.id_uuid,
+                id_uuid = (
+                    lpad(to_hex(floor(extract(epoch FROM p.created_at) * 1000)::bigint), 12, '0')
+                    || '7' || substr(r.hex, 1, 3)
+                    || substr('89ab', 1 + floor(random() * 4)::int, 1)
+                    || substr(r.hex, 4, 11)
+                    || $2
+                )::uuid,
+                version = p.version + 1
+            FROM batch b, LATERAL (SELECT md5(random()::text || b.id) AS hex) r
+            WHERE p.id = b.id
+        )sql";
+        try {
+            auto r = co_await db->execSqlCoro(remapSql, tag);
+            if (r.affectedRows() > 0) {
+                LOG_WARN << "uuid v7 migration: " << r.affectedRows()
+                         << " posts retagged to shard " << tag;
+            }
+        } catch (const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << "uuid v7 retagging failed: " << e.base().what();
+            co_return;
+        }
+        size_t total = 0;
+        try {
+            for (;;) {
+                auto r = co_await db->execSqlCoro(sql, std::to_string(batch), tag);
+                if (r.affectedRows() == 0) {
+                    break;
+                }
+                total += r.affectedRows();
+                LOG_INFO << "uuid v7 migration: " << total << " posts";
+            }
+        } catch (const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << "uuid v7 migration stopped after " << total
+                      << " posts: " << e.base().what();
+            co_return;
+        }
+        LOG_INFO << "uuid v7 migration finished, " << total << " posts";
+    });
+}
+
+// CLI-режим переноса постов, сервер при этом не запускается:
+//   drogon_app export [login] > posts.ndjson
+//   drogon_app import < posts.ndjson
+// Схема должна быть создана сервером заранее. stdout занят данными,
+// поэтому лог и итог с rows/s идут в stderr.
+int runTransferCommand(const std::string &command, int argc, char **argv) {
+    trantor::Logger::setOutputFunction(
+        [](const char *msg, const uint64_t len) {
+            std::fwrite(msg, 1, len, stderr);
+        },
+        [] { std::fflush(stderr); }
+    );
+    auto connectionStrings =
+        ShardRouter::resolveConnectionStrings(pgConnectionString());
+    if (command == "export") {
+        PostTransfer::Export transfer(
+            std::move(connectionStrings), argc > 2 ? argv[2] : ""
+        );
+        std::vector<char> buffer(64 * 1024);
+        while (size_t n = transfer.read(buffer.data(), buffer.size())) {
+            if (std::fwrite(buffer.data(), 1, n, stdout) != n) {
+                return 1;
+            }
+        }
+        std::fflush(stdout);
+        return transfer.report().error.empty() ? 0 : 1;
+    }
+    if (command == "import") {
+        std::ios::sync_with_stdio(false);
+        auto report =
+            PostTransfer::instance().importPosts(connectionStrings, std::cin);
+        std::fprintf(stderr, "%llu rows, %llu inserted, %llu skipped\n",
+                     (unsigned long long)report.rows,
+                     (unsigned long long)report.inserted,
+                     (unsigned long long)report.skipped);
+        return report.error.empty() ? 0 : 1;
+    }
+    std::fprintf(stderr, "usage: %s [export [login] | import]\n", argv[0]);
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        return runTransferCommand(argv[1], argc, argv);
+    }
+
     drogon::app().loadConfigFile("../config.json");
+    // fork до запуска любых потоков: AsyncLog, пулы и клиенты базы
+    // создаются уже в каждом воркере.
+    Supervisor::instance().configure(drogon::app().getCustomConfig()["workers"]);
+    if (Supervisor::instance().enabled()) {
+        if (auto code = Supervisor::instance().run()) {
+            return *code;
+        }
+    }
+
+    AsyncLog::instance().configure(drogon::app().getCustomConfig()["logging"]);
     LOG_INFO << "Config loaded";
 
-    auto db = getDbClient();
-    if (!db) {
-        LOG_FATAL << "Cannot get database client!";
-        return 1;
+    Topology::instance().configure(
+        drogon::app().getCustomConfig()["topology"],
+        Supervisor::instance().slot(), Supervisor::instance().processes()
+    );
+    Topology::instance().apply();
+
+    QueryLog::instance().configure(
+        drogon::app().getCustomConfig()["slow_query"]
+    );
+    SingleFlight::instance().configure(
+        drogon::app().getCustomConfig()["single_flight"]
+    );
+
+    // Окно read-your-writes ReplicaRouter и AvailabilityFilter живут в
+    // памяти процесса: соседний воркер не знает о записи, сделанной в этом.
+    // С несколькими воркерами чтения идут только в primary, а доступность
+    // логина всегда проверяется в базе.
+    bool singleProcess = Supervisor::instance().processes() == 1;
+    // Схему, миграцию и чистку базы выполняет один воркер: параллельный DDL
+    // из нескольких процессов ловит гонки в системном каталоге.
+    bool schemaOwner = Supervisor::instance().slot() == 0;
+
+    if (!singleProcess && schemaOwner) {
+        LOG_WARN << Supervisor::instance().processes()
+                 << " worker processes: replica reads are disabled, all "
+                    "reads go to primaries";
+        LOG_WARN << Supervisor::instance().processes()
+                 << " worker processes: login availability filter is "
+                    "disabled, every check goes to the database";
+        LOG_INFO << Supervisor::instance().processes()
+                 << " worker processes: live events are relayed between "
+                    "workers through LISTEN/NOTIFY";
+    }
+
+    ShardRouter::instance().configure(
+        drogon::app().getCustomConfig(), pgConnectionString(), singleProcess
+    );
+    ShardRouter::instance().start(drogon::app().getLoop());
+    LOG_INFO << "Database clients obtained successfully";
+
+    // У primary одно соединение, поэтому запросы прогрева выполнятся после
+    // DDL из setupDatabase. По той же причине SELECT 1 завершится после
+    // DDL, и только тогда слот 0 сообщит о готовности, а supervisor
+    // запустит остальные слоты.
+    if (schemaOwner) {
+        for (const auto &db : ShardRouter::instance().primaries()) {
+            setupDatabase(db);
+            Supervisor::instance().holdReady();
+            db->execSqlAsync(
+                R"sql(SELECT 1)sql",
+                [](const drogon::orm::Result &) {
+                    Supervisor::instance().releaseReady();
+                },
+                [](const drogon::orm::DrogonDbException &e) {
+                    LOG_ERROR << e.base().what();
+                    Supervisor::instance().releaseReady();
+                }
+            );
+        }
+    }
+
+    const auto &uuidMigration =
+        drogon::app().getCustomConfig()["uuid_migration"];
+    if (schemaOwner && uuidMigration.get("enabled", false).asBool()) {
+        auto primaries = ShardRouter::instance().primaries();
+        for (size_t shard = 0; shard < primaries.size(); ++shard) {
+            migratePostUuids(
+                primaries[shard], shard,
+                uuidMigration.get("batch", 1000).asUInt64()
+            );
+        }
+    }
+
+    AvailabilityFilter::instance().configure(
+        drogon::app().getCustomConfig()["availability"]
+    );
+    if (singleProcess) {
+        AvailabilityFilter::instance().load();
+    }
+
+    ReactionBuffer::instance().configure(
+        drogon::app().getCustomConfig()["reactions"]
+    );
+    ReactionBuffer::instance().start(drogon::app().getLoop());
+
+    FeedHub::instance().configure(drogon::app().getCustomConfig()["live"]);
+    if (!singleProcess) {
+        FeedHub::instance().listen(drogon::app().getLoop());
     }
-    LOG_INFO << "Database client obtained successfully";
 
-    drogon::app().getLoop()->queueInLoop([]() { setupDatabase(); });
+    IdempotencyStore::instance().configure(
+        drogon::app().getCustomConfig()["idempotency"]
+    );
+    IdempotencyStore::instance().start(drogon::app().getLoop(), schemaOwner);
+
+    MediaStore::instance().configure(drogon::app().getCustomConfig()["media"]);
+
+    PostCache::instance().configure(
+        drogon::app().getCustomConfig()["post_cache"]
+    );
+
+    TokenCache::instance().configure(
+        drogon::app().getCustomConfig()["token_cache"]
+    );
+
+    AdmissionControl::instance().configure(
+        drogon::app().getCustomConfig()["admission"]
+    );
+    AdmissionControl::instance().install(drogon::app().getLoop());
+
+    Profiler::instance().configure(drogon::app().getCustomConfig()["profiling"]);
+
+    Warmup::instance().configure(drogon::app().getCustomConfig()["warmup"]);
+    Warmup::instance().run();
+
+    Supervisor::instance().startWorker(drogon::app().getLoop());
 
     drogon::app().run();
     return 0;
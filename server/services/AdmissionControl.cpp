@@ -0,0 +1,268 @@
+#include "AdmissionControl.h"
+#include <drogon/drogon.h>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+using namespace std::chrono;
+
+AdmissionControl &AdmissionControl::instance() {
+    static AdmissionControl control;
+    return control;
+}
+
+AdmissionControl::AdmissionControl() {
+    const char *names[KindCount] = {"auth", "read", "write", "feed", "search"};
+    const double maxLimits[KindCount] = {64, 128, 64, 64, 16};
+    for (int kind = 0; kind < KindCount; ++kind) {
+        routes_[kind].name = names[kind];
+        routes_[kind].maxLimit = maxLimits[kind];
+        routes_[kind].minLimit = std::max(1.0, maxLimits[kind] / 8);
+        routes_[kind].limit = maxLimits[kind];
+    }
+}
+
+void AdmissionControl::configure(const Json::Value &config) {
+    targetLatencyMs_ =
+        config.get("target_latency_ms", targetLatencyMs_).asDouble();
+    backoff_ = config.get("backoff", backoff_).asDouble();
+    queueDeadlineMs_ =
+        config.get("queue_deadline_ms", queueDeadlineMs_).asDouble();
+    maxQueue_ = config.get("max_queue", (Json::UInt64)maxQueue_).asUInt64();
+    lowPriorityShare_ =
+        config.get("low_priority_share", lowPriorityShare_).asDouble();
+    deepPageOffset_ = config.get("deep_page_offset", deepPageOffset_).asInt();
+    for (auto &route : routes_) {
+        const auto &routeConfig = config["routes"][route.name];
+        route.maxLimit =
+            routeConfig.get("max_in_flight", route.maxLimit).asDouble();
+        route.minLimit =
+            routeConfig.get("min_in_flight", route.minLimit).asDouble();
+        route.limit = route.maxLimit;
+    }
+}
+
+void AdmissionControl::install(trantor::EventLoop *loop) {
+    drogon::app().registerPreHandlingAdvice(
+        [this](
+            const drogon::HttpRequestPtr &req, drogon::AdviceCallback &&reject,
+            drogon::AdviceChainCallback &&proceed
+        ) { onRequest(req, std::move(reject), std::move(proceed)); }
+    );
+    loop->runEvery(queueDeadlineMs_ / 4000.0, [this]() { expireWaiters(); });
+}
+
+AdmissionControl::Route *AdmissionControl::classify(
+    const drogon::HttpRequestPtr &req,
+    Priority &priority
+) {
+    priority = Normal;
+    const auto &path = req->path();
+    auto startsWith = [&](const char *prefix) {
+        return path.rfind(prefix, 0) == 0;
+    };
+    auto endsWith = [&](const std::string &suffix) {
+        return path.size() >= suffix.size() &&
+               path.compare(path.size() - suffix.size(), suffix.size(), suffix) ==
+                   0;
+    };
+
+    // Проверки доступности идут на каждое нажатие клавиши и не должны
+    // занимать лимит входа и регистрации с bcrypt.
+    if (path == "/api/auth/available") {
+        return &routes_[Read];
+    }
+    if (startsWith("/api/auth/")) {
+        return &routes_[Auth];
+    }
+    if (!startsWith("/api/posts/") || path == "/api/posts/live") {
+        return nullptr;
+    }
+    if (startsWith("/api/posts/feed")) {
+        const auto &offset = req->getParameter("offset");
+        // Кривой offset отклонит сам контроллер.
+        if (offset.size() > 9 ||
+            (!offset.empty() &&
+             offset.find_first_not_of("0123456789") == std::string::npos &&
+             std::stoi(offset) > deepPageOffset_)) {
+            priority = Low;
+        }
+        return &routes_[Feed];
+    }
+    if (path == "/api/posts/search") {
+        priority = Low;
+        return &routes_[Search];
+    }
+    if (path == "/api/posts/new" || endsWith("/like") ||
+        endsWith("/dislike") || endsWith("/reaction")) {
+        return &routes_[Write];
+    }
+    return &routes_[Read];
+}
+
+void AdmissionControl::onRequest(
+    const drogon::HttpRequestPtr &req,
+    drogon::AdviceCallback &&reject,
+    drogon::AdviceChainCallback &&proceed
+) {
+    Priority priority;
+    auto route = classify(req, priority);
+    if (!route) {
+        proceed();
+        return;
+    }
+
+    // Запрос мог уже постоять в очередях drogon и сокета.
+    double ageMs = (trantor::Date::now().microSecondsSinceEpoch() -
+                    req->creationDate().microSecondsSinceEpoch()) /
+                   1000.0;
+    if (ageMs >= queueDeadlineMs_) {
+        ++route->expired;
+        reject(overloaded());
+        return;
+    }
+
+    enum { Admit, Queue, Shed } decision;
+    {
+        std::lock_guard<std::mutex> lock(route->mutex);
+        double limit = priority == Low ? route->limit * lowPriorityShare_
+                                       : route->limit;
+        if (route->queue.empty() && route->inFlight < limit) {
+            ++route->inFlight;
+            decision = Admit;
+        } else if (priority == Low || route->queue.size() >= maxQueue_) {
+            decision = Shed;
+        } else {
+            auto deadline = steady_clock::now() +
+                            duration_cast<steady_clock::duration>(
+                                duration<double, std::milli>(
+                                    queueDeadlineMs_ - ageMs
+                                )
+                            );
+            route->queue.push_back(Waiter{
+                req, trantor::EventLoop::getEventLoopOfCurrentThread(),
+                std::move(reject), std::move(proceed), deadline
+            });
+            decision = Queue;
+        }
+    }
+
+    if (decision == Admit) {
+        attachPermit(*route, req);
+        proceed();
+    } else if (decision == Shed) {
+        ++route->shed;
+        reject(overloaded());
+    }
+}
+
+void AdmissionControl::attachPermit(
+    Route &route,
+    const drogon::HttpRequestPtr &req
+) {
+    ++route.admitted;
+    auto permit = std::make_shared<Permit>();
+    permit->route = &route;
+    permit->start = steady_clock::now();
+    req->attributes()->insert("admission_permit", std::move(permit));
+}
+
+AdmissionControl::Permit::~Permit() {
+    if (route) {
+        AdmissionControl::instance().release(
+            *route,
+            duration<double, std::milli>(steady_clock::now() - start).count()
+        );
+    }
+}
+
+void AdmissionControl::release(Route &route, double latencyMs) {
+    std::vector<Waiter> ready;
+    std::vector<Waiter> expired;
+    auto now = steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(route.mutex);
+        --route.inFlight;
+        if (latencyMs > targetLatencyMs_) {
+            // Не чаще раза за target_latency_ms, иначе одна пачка медленных
+            // ответов сразу опустит лимит до минимума.
+            if (now - route.lastDecrease >
+                duration<double, std::milli>(targetLatencyMs_)) {
+                route.limit = std::max(route.minLimit, route.limit * backoff_);
+                route.lastDecrease = now;
+            }
+        } else {
+            route.limit = std::min(route.maxLimit, route.limit + 1 / route.limit);
+        }
+        while (!route.queue.empty() && route.inFlight < route.limit) {
+            auto waiter = std::move(route.queue.front());
+            route.queue.pop_front();
+            if (waiter.deadline < now) {
+                expired.push_back(std::move(waiter));
+            } else {
+                ++route.inFlight;
+                ready.push_back(std::move(waiter));
+            }
+        }
+    }
+
+    for (auto &waiter : ready) {
+        attachPermit(route, waiter.req);
+        waiter.loop->queueInLoop(std::move(waiter.proceed));
+    }
+    for (auto &waiter : expired) {
+        ++route.expired;
+        waiter.loop->queueInLoop([reject = std::move(waiter.reject)]() {
+            reject(overloaded());
+        });
+    }
+}
+
+void AdmissionControl::expireWaiters() {
+    auto now = steady_clock::now();
+    for (auto &route : routes_) {
+        std::vector<Waiter> expired;
+        {
+            std::lock_guard<std::mutex> lock(route.mutex);
+            auto it = std::stable_partition(
+                route.queue.begin(), route.queue.end(),
+                [&](const Waiter &waiter) { return waiter.deadline >= now; }
+            );
+            std::move(it, route.queue.end(), std::back_inserter(expired));
+            route.queue.erase(it, route.queue.end());
+        }
+        for (auto &waiter : expired) {
+            ++route.expired;
+            waiter.loop->queueInLoop([reject = std::move(waiter.reject)]() {
+                reject(overloaded());
+            });
+        }
+    }
+}
+
+drogon::HttpResponsePtr AdmissionControl::overloaded() {
+    Json::Value ret;
+    ret["reason"] = "Server is overloaded, retry later";
+    auto resp = drogon::HttpResponse::newHttpJsonResponse(std::move(ret));
+    resp->setStatusCode(drogon::k503ServiceUnavailable);
+    resp->addHeader("Retry-After", "1");
+    return resp;
+}
+
+Json::Value AdmissionControl::stats() const {
+    Json::Value ret(Json::objectValue);
+    for (const auto &route : routes_) {
+        Json::Value stat;
+        {
+            std::lock_guard<std::mutex> lock(route.mutex);
+            stat["limit"] = route.limit;
+            stat["inFlight"] = (Json::UInt64)route.inFlight;
+            stat["queued"] = (Json::UInt64)route.queue.size();
+        }
+        stat["admitted"] = (Json::UInt64)route.admitted.load();
+        stat["shed"] = (Json::UInt64)route.shed.load();
+        stat["expired"] = (Json::UInt64)route.expired.load();
+        ret[route.name] = std::move(stat);
+    }
+    return ret;
+}
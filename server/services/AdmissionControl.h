@@ -0,0 +1,85 @@
+#pragma once
+#include <drogon/HttpRequest.h>
+#include <drogon/HttpResponse.h>
+#include <trantor/net/EventLoop.h>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Допуск запросов к контроллерам. У каждой группы маршрутов свой лимит
+// одновременных запросов, который подстраивается под задержку (AIMD):
+// растет на 1/limit за быстрый ответ и умножается на backoff, если ответ
+// медленнее target_latency_ms. Сверх лимита запрос ждет в очереди не
+// дольше queue_deadline_ms, считая от получения запроса. Низкоприоритетные
+// запросы (глубокие страницы лент, поиск) не ждут и получают 503 первыми.
+class AdmissionControl {
+public:
+    static AdmissionControl &instance();
+
+    void configure(const Json::Value &config);
+
+    // Регистрирует pre-handling advice и таймер, снимающий просроченные
+    // ожидания. Вызывается до app().run().
+    void install(trantor::EventLoop *loop);
+
+    Json::Value stats() const;
+
+private:
+    enum Kind { Auth, Read, Write, Feed, Search, KindCount };
+    enum Priority { Low, Normal };
+
+    struct Waiter {
+        drogon::HttpRequestPtr req;
+        trantor::EventLoop *loop;
+        drogon::AdviceCallback reject;
+        drogon::AdviceChainCallback proceed;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    struct Route {
+        const char *name = "";
+        double minLimit = 1;
+        double maxLimit = 64;
+        mutable std::mutex mutex;
+        double limit = 64;
+        size_t inFlight = 0;
+        std::deque<Waiter> queue;
+        std::chrono::steady_clock::time_point lastDecrease;
+        std::atomic<uint64_t> admitted{0};
+        std::atomic<uint64_t> shed{0};
+        std::atomic<uint64_t> expired{0};
+    };
+
+    // Живет в атрибутах запроса: слот освобождается, когда запрос
+    // обработан и отпущен, даже если обработчик бросил исключение.
+    struct Permit {
+        Route *route = nullptr;
+        std::chrono::steady_clock::time_point start;
+        ~Permit();
+    };
+
+    AdmissionControl();
+
+    Route *classify(const drogon::HttpRequestPtr &req, Priority &priority);
+    void onRequest(
+        const drogon::HttpRequestPtr &req,
+        drogon::AdviceCallback &&reject,
+        drogon::AdviceChainCallback &&proceed
+    );
+    void release(Route &route, double latencyMs);
+    void expireWaiters();
+    static void attachPermit(Route &route, const drogon::HttpRequestPtr &req);
+    static drogon::HttpResponsePtr overloaded();
+
+    Route routes_[KindCount];
+    double targetLatencyMs_ = 250;
+    double backoff_ = 0.9;
+    double queueDeadlineMs_ = 500;
+    size_t maxQueue_ = 100;
+    double lowPriorityShare_ = 0.5;
+    int deepPageOffset_ = 100;
+};
@@ -0,0 +1,295 @@
+#include "AsyncLog.h"
+#include <drogon/drogon.h>
+#include <trantor/utils/Date.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <random>
+
+struct AsyncLog::Ring {
+    explicit Ring(size_t size) : slots(size) {
+    }
+
+    std::vector<std::string> slots;
+    // head двигает только поток-владелец, tail — только выгрузка под
+    // drainMutex_.
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+};
+
+// Уровень стоит в начале строки trantor после даты и номера потока.
+static bool isErrorLine(const char *msg, uint64_t len) {
+    std::string_view head(msg, std::min<uint64_t>(len, 64));
+    return head.find(" ERROR ") != std::string_view::npos ||
+           head.find(" FATAL ") != std::string_view::npos;
+}
+
+static void appendFieldValue(std::string &line, std::string_view value) {
+    bool plain = !value.empty() &&
+                 std::none_of(value.begin(), value.end(), [](char c) {
+                     return c == ' ' || c == '"' || c == '\\' || c == '=' ||
+                            static_cast<unsigned char>(c) < 0x20 ||
+                            c == 0x7f;
+                 });
+    if (plain) {
+        line += value;
+        return;
+    }
+    line += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':
+                line += "\\\"";
+                break;
+            case '\\':
+                line += "\\\\";
+                break;
+            case '\n':
+                line += "\\n";
+                break;
+            case '\r':
+                line += "\\r";
+                break;
+            case '\t':
+                line += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+                    char escaped[5];
+                    std::snprintf(
+                        escaped, sizeof(escaped), "\\x%02x",
+                        static_cast<unsigned char>(c)
+                    );
+                    line += escaped;
+                } else {
+                    line += c;
+                }
+                break;
+        }
+    }
+    line += '"';
+}
+
+AsyncLog &AsyncLog::instance() {
+    static AsyncLog log;
+    return log;
+}
+
+void AsyncLog::configure(const Json::Value &config) {
+    ringSize_ =
+        std::max<size_t>(16, config.get("ring_size", (Json::UInt64)ringSize_)
+                                 .asUInt64());
+    flushIntervalMs_ =
+        config.get("flush_interval_ms", flushIntervalMs_).asDouble();
+    for (const auto &name : config["categories"].getMemberNames()) {
+        const auto &categoryConfig = config["categories"][name];
+        auto category = std::make_unique<Category>();
+        category->sampleRate =
+            categoryConfig.get("sample_rate", 1.0).asDouble();
+        category->maxPerSec = categoryConfig.get("max_per_sec", 0).asUInt();
+        categories_.emplace(name, std::move(category));
+    }
+
+    auto file = config.get("file", "").asString();
+    if (!file.empty()) {
+        out_ = std::fopen(file.c_str(), "a");
+        if (!out_) {
+            LOG_ERROR << "Failed to open log file " << file;
+            out_ = stderr;
+        }
+    }
+
+    writer_ = std::thread([this]() { run(); });
+
+    if (config.get("capture_drogon_log", false).asBool()) {
+        capturing_ = true;
+        trantor::Logger::setOutputFunction(
+            [this](const char *msg, uint64_t len) {
+                if (isErrorLine(msg, len)) {
+                    writeNow(msg, len);
+                    return;
+                }
+                // Строка drogon уже отформатирована и заканчивается '\n'.
+                if (len > 0 && msg[len - 1] == '\n') {
+                    --len;
+                }
+                auto it = categories_.find("drogon");
+                if (admit(it == categories_.end() ? defaultCategory_
+                                                  : *it->second)) {
+                    push(std::string(msg, len));
+                }
+            },
+            []() {}
+        );
+    }
+}
+
+AsyncLog::~AsyncLog() {
+    // Функция вывода ссылается на this, а trantor может логировать и после
+    // разрушения статических объектов.
+    if (capturing_) {
+        trantor::Logger::setOutputFunction(
+            [](const char *msg, uint64_t len) {
+                std::fwrite(msg, 1, len, stdout);
+            },
+            []() { std::fflush(stdout); }
+        );
+        capturing_ = false;
+    }
+    if (!writer_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    if (out_ != stderr) {
+        std::fclose(out_);
+    }
+}
+
+AsyncLog::Ring &AsyncLog::localRing() {
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        ring = std::make_shared<Ring>(ringSize_);
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        rings_.push_back(ring);
+    }
+    return *ring;
+}
+
+bool AsyncLog::admit(Category &category) {
+    if (category.sampleRate < 1.0) {
+        thread_local std::minstd_rand rng(std::random_device{}());
+        if (std::uniform_real_distribution<double>(0, 1)(rng) >=
+            category.sampleRate) {
+            ++category.sampledOut;
+            return false;
+        }
+    }
+    if (category.maxPerSec > 0) {
+        // Окно в секунду сбрасывает тот поток, который первым его заметил;
+        // на границе окна лимит может быть превышен на несколько строк.
+        int64_t now = trantor::Date::now().secondsSinceEpoch();
+        int64_t second = category.second.load(std::memory_order_relaxed);
+        if (second != now &&
+            category.second.compare_exchange_strong(second, now)) {
+            category.inSecond = 0;
+        }
+        if (++category.inSecond > category.maxPerSec) {
+            ++category.rateLimited;
+            return false;
+        }
+    }
+    return true;
+}
+
+void AsyncLog::event(
+    std::string_view category,
+    std::string_view message,
+    std::initializer_list<Field> fields
+) {
+    auto it = categories_.find(std::string(category));
+    if (!admit(it == categories_.end() ? defaultCategory_ : *it->second)) {
+        return;
+    }
+    std::string line =
+        trantor::Date::now().toFormattedString(true) + ' ' +
+        std::string(category) + ' ' + std::string(message);
+    for (const auto &field : fields) {
+        line += ' ';
+        line += field.key;
+        line += '=';
+        appendFieldValue(line, field.value);
+    }
+    push(std::move(line));
+}
+
+void AsyncLog::push(std::string &&line) {
+    auto &ring = localRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= ring.slots.size()) {
+        ++dropped_;
+        return;
+    }
+    ring.slots[head % ring.slots.size()] = std::move(line);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void AsyncLog::run() {
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    while (!stop_) {
+        wake_.wait_for(
+            lock, std::chrono::duration<double, std::milli>(flushIntervalMs_)
+        );
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+    lock.unlock();
+    drain();
+}
+
+void AsyncLog::drain() {
+    std::lock_guard<std::mutex> lock(drainMutex_);
+    drainLocked();
+}
+
+// Строки, накопленные до ошибки, пишутся раньше нее.
+void AsyncLog::writeNow(const char *msg, uint64_t len) {
+    std::lock_guard<std::mutex> lock(drainMutex_);
+    drainLocked();
+    std::fwrite(msg, 1, len, out_);
+    std::fflush(out_);
+    ++written_;
+}
+
+void AsyncLog::drainLocked() {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        rings = rings_;
+    }
+    std::string batch;
+    uint64_t lines = 0;
+    for (auto &ring : rings) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            auto &slot = ring->slots[tail % ring->slots.size()];
+            batch += slot;
+            batch += '\n';
+            slot.clear();
+            ++lines;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    uint64_t dropped = dropped_.load();
+    if (dropped != reportedDropped_) {
+        batch += trantor::Date::now().toFormattedString(true) +
+                 " log dropped=" + std::to_string(dropped - reportedDropped_) +
+                 " total_dropped=" + std::to_string(dropped) + '\n';
+        reportedDropped_ = dropped;
+    }
+    if (!batch.empty()) {
+        std::fwrite(batch.data(), 1, batch.size(), out_);
+        std::fflush(out_);
+        written_ += lines;
+    }
+}
+
+Json::Value AsyncLog::stats() const {
+    Json::Value ret;
+    ret["written"] = (Json::UInt64)written_.load();
+    ret["dropped"] = (Json::UInt64)dropped_.load();
+    Json::Value categories(Json::objectValue);
+    for (const auto &[name, category] : categories_) {
+        Json::Value stat;
+        stat["sampledOut"] = (Json::UInt64)category->sampledOut.load();
+        stat["rateLimited"] = (Json::UInt64)category->rateLimited.load();
+        categories[name] = std::move(stat);
+    }
+    ret["categories"] = std::move(categories);
+    return ret;
+}
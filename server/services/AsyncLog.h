@@ -0,0 +1,91 @@
+#pragma once
+#include <json/json.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Неблокирующий лог для горячих путей. Каждый поток пишет готовую строку в
+// свой кольцевой буфер (один писатель, один читатель, без блокировок), а
+// фоновый поток раз в flush_interval_ms выгружает все буферы в файл. Если
+// буфер полон, строка отбрасывается и учитывается в dropped. Для категорий
+// задаются доля сэмплирования и лимит строк в секунду. Строки drogon уровня
+// ERROR и FATAL не ждут фонового потока: буферы выгружаются, и строка
+// пишется сразу, чтобы не потеряться при падении процесса.
+class AsyncLog {
+public:
+    struct Field {
+        std::string_view key;
+        std::string value;
+    };
+
+    static AsyncLog &instance();
+
+    // Запускает фоновый поток; при capture_drogon_log вывод LOG_* тоже идет
+    // через буферы.
+    void configure(const Json::Value &config);
+
+    // Строка вида "<время> <category> <message> key=value ...". Значение с
+    // пробелами, кавычками, '=' или управляющими символами берется в
+    // кавычки и экранируется.
+    void event(
+        std::string_view category,
+        std::string_view message,
+        std::initializer_list<Field> fields = {}
+    );
+
+    Json::Value stats() const;
+
+    ~AsyncLog();
+
+private:
+    struct Ring;
+    struct Category {
+        double sampleRate = 1.0;
+        uint32_t maxPerSec = 0;
+        std::atomic<int64_t> second{0};
+        std::atomic<uint32_t> inSecond{0};
+        std::atomic<uint64_t> sampledOut{0};
+        std::atomic<uint64_t> rateLimited{0};
+    };
+
+    AsyncLog() = default;
+
+    Ring &localRing();
+    bool admit(Category &category);
+    void push(std::string &&line);
+    void run();
+    void drain();
+    void drainLocked();
+    void writeNow(const char *msg, uint64_t len);
+
+    size_t ringSize_ = 4096;
+    double flushIntervalMs_ = 100;
+    std::unordered_map<std::string, std::unique_ptr<Category>> categories_;
+    Category defaultCategory_;
+
+    std::mutex ringsMutex_;
+    std::vector<std::shared_ptr<Ring>> rings_;
+
+    FILE *out_ = stderr;
+    // Выгрузку выполняет фоновый поток, а при ошибках — поток, который ее
+    // залогировал.
+    std::mutex drainMutex_;
+    bool capturing_ = false;
+    std::thread writer_;
+    std::mutex wakeMutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reportedDropped_ = 0;
+};
@@ -0,0 +1,146 @@
+#include "AvailabilityFilter.h"
+#include <drogon/drogon.h>
+#include <drogon/utils/coroutine.h>
+#include <algorithm>
+#include <cmath>
+#include "db/ShardRouter.h"
+
+AvailabilityFilter &AvailabilityFilter::instance() {
+    static AvailabilityFilter filter;
+    return filter;
+}
+
+AvailabilityFilter::AvailabilityFilter() {
+    configure(Json::Value());
+}
+
+void AvailabilityFilter::configure(const Json::Value &config) {
+    // Логин, email и телефон — три элемента на пользователя.
+    double items =
+        3.0 * std::max<Json::UInt64>(
+                  1, config.get("expected_users", 1000000).asUInt64()
+              );
+    double rate = std::clamp(
+        config.get("false_positive_rate", 0.01).asDouble(), 1e-6, 0.5
+    );
+    pageSize_ = config.get("page_size", (Json::UInt64)pageSize_).asUInt64();
+    size_t bits = (size_t)std::ceil(-items * std::log(rate) /
+                                    (std::log(2.0) * std::log(2.0)));
+    bits_ = (bits + 63) / 64 * 64;
+    hashes_ = std::max(1, (int)std::round(bits_ / items * std::log(2.0)));
+    words_ = std::make_unique<std::atomic<uint64_t>[]>(bits_ / 64);
+    for (size_t i = 0; i < bits_ / 64; ++i) {
+        words_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t AvailabilityFilter::hash(Field field, std::string_view value) const {
+    // FNV-1a с типом поля в начале: логин и телефон с одинаковым текстом
+    // не совпадают.
+    uint64_t h = 1469598103934665603ull;
+    h = (h ^ (uint64_t)field) * 1099511628211ull;
+    for (unsigned char c : value) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Двойное хеширование: i-я позиция — h1 + i * h2, h2 получен из h1
+// перемешиванием splitmix64.
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return (x ^ (x >> 31)) | 1;
+}
+
+void AvailabilityFilter::add(Field field, std::string_view value) {
+    uint64_t h1 = hash(field, value), h2 = mix(h1);
+    for (int i = 0; i < hashes_; ++i) {
+        uint64_t bit = (h1 + i * h2) % bits_;
+        words_[bit / 64].fetch_or(
+            uint64_t(1) << (bit % 64), std::memory_order_relaxed
+        );
+    }
+    ++items_;
+}
+
+bool AvailabilityFilter::mightBeTaken(
+    Field field,
+    std::string_view value
+) const {
+    uint64_t h1 = hash(field, value), h2 = mix(h1);
+    for (int i = 0; i < hashes_; ++i) {
+        uint64_t bit = (h1 + i * h2) % bits_;
+        if (!(words_[bit / 64].load(std::memory_order_relaxed) &
+              (uint64_t(1) << (bit % 64)))) {
+            ++negatives_;
+            return false;
+        }
+    }
+    return true;
+}
+
+void AvailabilityFilter::recordDbCheck(bool taken) {
+    ++dbChecks_;
+    if (!taken) {
+        ++falsePositives_;
+    }
+}
+
+void AvailabilityFilter::load() {
+    auto &router = ShardRouter::instance();
+    for (size_t i = 0; i < router.count(); ++i) {
+        drogon::async_run(
+            [this, i, db = router.shard(i).primary]() -> drogon::Task<> {
+                static const std::string sql = R"sql(
+                    SELECT id, login, email, phone FROM users
+                    WHERE id > $1 ORDER BY id LIMIT $2
+                )sql";
+                int64_t lastId = 0;
+                try {
+                    for (;;) {
+                        auto r = co_await db->execSqlCoro(
+                            sql, std::to_string(lastId),
+                            std::to_string(pageSize_)
+                        );
+                        for (const auto &row : r) {
+                            add(Login, row["login"].as<std::string>());
+                            add(Email, row["email"].as<std::string>());
+                            add(Phone, row["phone"].as<std::string>());
+                            lastId = row["id"].as<int64_t>();
+                        }
+                        if (r.size() < pageSize_) {
+                            break;
+                        }
+                    }
+                } catch (const drogon::orm::DrogonDbException &e) {
+                    LOG_ERROR << "availability filter: loading shard " << i
+                              << " failed, checks stay in the database: "
+                              << e.base().what();
+                    co_return;
+                }
+                if (++shardsLoaded_ == ShardRouter::instance().count()) {
+                    ready_.store(true, std::memory_order_release);
+                    LOG_INFO << "availability filter ready, " << items_.load()
+                             << " items";
+                }
+            }
+        );
+    }
+}
+
+Json::Value AvailabilityFilter::stats() const {
+    uint64_t negatives = negatives_.load(), dbChecks = dbChecks_.load();
+    Json::Value ret;
+    ret["ready"] = ready();
+    ret["items"] = (Json::UInt64)items_.load();
+    ret["bits"] = (Json::UInt64)bits_;
+    ret["hashes"] = hashes_;
+    ret["servedFromFilter"] = (Json::UInt64)negatives;
+    ret["dbChecks"] = (Json::UInt64)dbChecks;
+    ret["falsePositives"] = (Json::UInt64)falsePositives_.load();
+    ret["filterShare"] = negatives + dbChecks
+                             ? (double)negatives / (negatives + dbChecks)
+                             : 0.0;
+    return ret;
+}
\ No newline at end of file
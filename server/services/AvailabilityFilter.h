@@ -0,0 +1,56 @@
+#pragma once
+#include <json/json.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Фильтр Блума занятых логинов, email и телефонов для проверки
+// доступности при вводе формы регистрации. Отрицательный ответ точный, и
+// база не нужна; положительный нужно подтвердить запросом. Фильтр
+// строится при старте постраничным чтением users со всех шардов и
+// пополняется registerUser. Пока он не достроен, все проверки идут в базу.
+// Удалений нет: пользователи не удаляются.
+class AvailabilityFilter {
+public:
+    enum Field { Login, Email, Phone };
+
+    static AvailabilityFilter &instance();
+
+    void configure(const Json::Value &config);
+
+    // Запускает построение фильтра; запросы встают в очередь primary
+    // после DDL из setupDatabase.
+    void load();
+
+    bool ready() const {
+        return ready_.load(std::memory_order_acquire);
+    }
+
+    void add(Field field, std::string_view value);
+    // false — значение точно свободно.
+    bool mightBeTaken(Field field, std::string_view value) const;
+
+    // Учет результата проверки в базе после положительного ответа.
+    void recordDbCheck(bool taken);
+
+    Json::Value stats() const;
+
+private:
+    AvailabilityFilter();
+
+    uint64_t hash(Field field, std::string_view value) const;
+
+    size_t bits_ = 0;
+    int hashes_ = 0;
+    size_t pageSize_ = 10000;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+
+    std::atomic<bool> ready_{false};
+    std::atomic<size_t> shardsLoaded_{0};
+    std::atomic<uint64_t> items_{0};
+    mutable std::atomic<uint64_t> negatives_{0};
+    std::atomic<uint64_t> dbChecks_{0};
+    std::atomic<uint64_t> falsePositives_{0};
+};
@@ -0,0 +1,227 @@
+#include "FeedHub.h"
+#include <drogon/drogon.h>
+#include <algorithm>
+#include <deque>
+#include <unordered_set>
+#include "db/ShardRouter.h"
+
+namespace {
+
+const std::string kChannel = "posts_live";
+
+}  // namespace
+
+struct FeedHub::Event {
+    std::string postUuid;
+    std::string author;
+    bool authorPublic;
+};
+
+struct FeedHub::Subscriber {
+    std::string login;
+    std::weak_ptr<trantor::TcpConnection> tcp;
+    // Сколько байт соединение должно было отправить к этому моменту, в
+    // счете bytesSent().
+    size_t queuedBytes = 0;
+    std::deque<std::shared_ptr<const Event>> pending;
+    bool overflowed = false;
+    int overflowWindows = 0;
+};
+
+struct FeedHub::LoopState {
+    std::unordered_set<drogon::WebSocketConnectionPtr> connections;
+    bool timerStarted = false;
+};
+
+FeedHub &FeedHub::instance() {
+    static FeedHub hub;
+    return hub;
+}
+
+void FeedHub::configure(const Json::Value &config) {
+    flushIntervalSec_ =
+        config.get("flush_interval_ms", 100).asDouble() / 1000.0;
+    maxQueue_ = config.get("max_queue", (Json::UInt64)maxQueue_).asUInt64();
+    maxOverflowWindows_ =
+        config.get("max_overflow_windows", maxOverflowWindows_).asInt();
+    maxPendingBytes_ =
+        config.get("max_pending_bytes", (Json::UInt64)maxPendingBytes_)
+            .asUInt64();
+}
+
+FeedHub::LoopState &FeedHub::localState() {
+    thread_local LoopState state;
+    return state;
+}
+
+void FeedHub::subscribe(
+    const drogon::WebSocketConnectionPtr &conn,
+    const std::string &login,
+    std::weak_ptr<trantor::TcpConnection> tcp
+) {
+    auto tcpConn = tcp.lock();
+    if (!conn->connected() || !tcpConn) {
+        return;
+    }
+    auto subscriber = std::make_shared<Subscriber>();
+    subscriber->login = login;
+    subscriber->tcp = std::move(tcp);
+    subscriber->queuedBytes = tcpConn->bytesSent();
+    conn->setContext(subscriber);
+
+    auto &state = localState();
+    if (!state.timerStarted) {
+        state.timerStarted = true;
+        auto loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+        {
+            std::lock_guard<std::mutex> lock(loopsMutex_);
+            loops_.push_back(loop);
+        }
+        loop->runEvery(flushIntervalSec_, [this, &state]() {
+            flushLoop(state);
+        });
+    }
+    if (state.connections.insert(conn).second) {
+        ++subscribers_;
+    }
+}
+
+void FeedHub::unsubscribe(const drogon::WebSocketConnectionPtr &conn) {
+    if (localState().connections.erase(conn)) {
+        --subscribers_;
+    }
+}
+
+// Полезная нагрузка NOTIFY — "<uuid> <author> <0|1>": в uuid и логине
+// пробелов не бывает.
+void FeedHub::listen(trantor::EventLoop *loop) {
+    shared_ = true;
+    for (const auto &connectionString :
+         ShardRouter::instance().connectionStrings()) {
+        auto listener =
+            drogon::orm::DbListener::newPgListener(connectionString, loop);
+        listener->listen(kChannel, [this](std::string payload) {
+            auto first = payload.find(' ');
+            auto second = payload.rfind(' ');
+            if (first == std::string::npos || second <= first) {
+                LOG_ERROR << "Malformed live event: " << payload;
+                return;
+            }
+            deliver(std::make_shared<const Event>(Event{
+                payload.substr(0, first),
+                payload.substr(first + 1, second - first - 1),
+                payload.compare(second + 1, std::string::npos, "1") == 0
+            }));
+        });
+        listeners_.push_back(std::move(listener));
+    }
+}
+
+void FeedHub::publish(
+    const std::string &postUuid,
+    const std::string &author,
+    bool authorPublic
+) {
+    ++published_;
+    if (shared_) {
+        ShardRouter::instance().forLogin(author).primary->execSqlAsync(
+            R"sql(SELECT pg_notify($1, $2))sql",
+            [](const drogon::orm::Result &) {},
+            [](const drogon::orm::DrogonDbException &e) {
+                LOG_ERROR << "Failed to publish live event: "
+                          << e.base().what();
+            },
+            kChannel,
+            postUuid + ' ' + author + (authorPublic ? " 1" : " 0")
+        );
+        return;
+    }
+    deliver(
+        std::make_shared<const Event>(Event{postUuid, author, authorPublic})
+    );
+}
+
+void FeedHub::deliver(std::shared_ptr<const Event> event) {
+    std::vector<trantor::EventLoop *> loops;
+    {
+        std::lock_guard<std::mutex> lock(loopsMutex_);
+        loops = loops_;
+    }
+    for (auto loop : loops) {
+        loop->queueInLoop([this, event]() {
+            for (const auto &conn : localState().connections) {
+                auto subscriber = conn->getContext<Subscriber>();
+                if (!subscriber || (!event->authorPublic &&
+                                    subscriber->login != event->author)) {
+                    continue;
+                }
+                if (subscriber->pending.size() >= maxQueue_) {
+                    subscriber->pending.pop_front();
+                    subscriber->overflowed = true;
+                    ++droppedEvents_;
+                }
+                subscriber->pending.push_back(event);
+            }
+        });
+    }
+}
+
+// Соединение, которое переполняет очередь несколько окон подряд или не
+// забирает больше max_pending_bytes уже отправленного, считается медленным
+// и закрывается; клиент переподключится и перечитает ленту.
+void FeedHub::flushLoop(LoopState &state) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::vector<drogon::WebSocketConnectionPtr> slow;
+    for (const auto &conn : state.connections) {
+        auto subscriber = conn->getContext<Subscriber>();
+        if (!subscriber || subscriber->pending.empty()) {
+            continue;
+        }
+        // send() копит кадры в буфере соединения без ограничений. В
+        // bytesSent входят и заголовки кадров WebSocket, поэтому он может
+        // обогнать queuedBytes.
+        auto tcp = subscriber->tcp.lock();
+        size_t sent = tcp ? tcp->bytesSent() : 0;
+        if (!tcp || (sent < subscriber->queuedBytes &&
+                     subscriber->queuedBytes - sent > maxPendingBytes_)) {
+            slow.push_back(conn);
+            continue;
+        }
+        if (subscriber->overflowed) {
+            if (++subscriber->overflowWindows >= maxOverflowWindows_) {
+                slow.push_back(conn);
+                continue;
+            }
+        } else {
+            subscriber->overflowWindows = 0;
+        }
+
+        Json::Value frame;
+        frame["type"] = subscriber->overflowed ? "resync" : "posts";
+        Json::Value ids(Json::arrayValue);
+        for (const auto &event : subscriber->pending) {
+            ids.append(event->postUuid);
+        }
+        frame["ids"] = std::move(ids);
+        subscriber->pending.clear();
+        subscriber->overflowed = false;
+        auto message = Json::writeString(builder, frame);
+        subscriber->queuedBytes = std::max(subscriber->queuedBytes, sent) +
+                                  message.size();
+        conn->send(message);
+    }
+    for (const auto &conn : slow) {
+        state.connections.erase(conn);
+        --subscribers_;
+        ++droppedConnections_;
+        conn->shutdown(drogon::CloseCode::kViolation, "Slow consumer");
+    }
+}
+
+FeedHub::Stats FeedHub::stats() const {
+    return {
+        subscribers_.load(), published_.load(), droppedEvents_.load(),
+        droppedConnections_.load()
+    };
+}
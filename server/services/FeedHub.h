@@ -0,0 +1,84 @@
+#pragma once
+#include <drogon/WebSocketConnection.h>
+#include <drogon/orm/DbListener.h>
+#include <trantor/net/EventLoop.h>
+#include <trantor/net/TcpConnection.h>
+#include <json/json.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Рассылка id новых постов подписчикам /api/posts/live. Подписчики хранятся
+// по event loop'ам: publish ставит по одной задаче в каждый loop, а дальше
+// каждый loop работает только со своими соединениями без блокировок.
+//
+// При нескольких воркерах события идут через LISTEN/NOTIFY: publish
+// отправляет NOTIFY в primary шарда автора, а каждый воркер слушает канал
+// на всех шардах и раздает событие своим подписчикам, включая воркер,
+// создавший пост.
+class FeedHub {
+public:
+    struct Stats {
+        uint64_t subscribers;
+        uint64_t published;
+        uint64_t droppedEvents;
+        uint64_t droppedConnections;
+    };
+
+    static FeedHub &instance();
+
+    void configure(const Json::Value &config);
+
+    // Включает рассылку между процессами. Вызывается после
+    // ShardRouter::configure.
+    void listen(trantor::EventLoop *loop);
+
+    // Вызывается из loop'а соединения. tcp — соединение, на котором
+    // открыт WebSocket: по нему видно, сколько отправленного клиент еще не
+    // забрал.
+    void subscribe(
+        const drogon::WebSocketConnectionPtr &conn,
+        const std::string &login,
+        std::weak_ptr<trantor::TcpConnection> tcp
+    );
+    void unsubscribe(const drogon::WebSocketConnectionPtr &conn);
+
+    // Пост приватного автора уходит только самому автору.
+    void publish(
+        const std::string &postUuid,
+        const std::string &author,
+        bool authorPublic
+    );
+
+    Stats stats() const;
+
+private:
+    struct Event;
+    struct Subscriber;
+    struct LoopState;
+
+    FeedHub() = default;
+
+    LoopState &localState();
+    void deliver(std::shared_ptr<const Event> event);
+    void flushLoop(LoopState &state);
+
+    double flushIntervalSec_ = 0.1;
+    size_t maxQueue_ = 256;
+    int maxOverflowWindows_ = 5;
+    size_t maxPendingBytes_ = 1 << 20;
+
+    std::mutex loopsMutex_;
+    std::vector<trantor::EventLoop *> loops_;
+
+    bool shared_ = false;
+    std::vector<drogon::orm::DbListenerPtr> listeners_;
+
+    std::atomic<uint64_t> subscribers_{0};
+    std::atomic<uint64_t> published_{0};
+    std::atomic<uint64_t> droppedEvents_{0};
+    std::atomic<uint64_t> droppedConnections_{0};
+};
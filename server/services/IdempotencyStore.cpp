@@ -0,0 +1,190 @@
+#include "IdempotencyStore.h"
+#include <drogon/drogon.h>
+#include "db/ShardRouter.h"
+
+IdempotencyStore &IdempotencyStore::instance() {
+    static IdempotencyStore store;
+    return store;
+}
+
+void IdempotencyStore::configure(const Json::Value &config) {
+    ttlSec_ = config.get("ttl_sec", ttlSec_).asDouble();
+    inFlightTimeoutSec_ =
+        config.get("in_flight_timeout_sec", inFlightTimeoutSec_).asDouble();
+    maxEntries_ =
+        config.get("max_entries", (Json::UInt64)maxEntries_).asUInt64();
+}
+
+void IdempotencyStore::start(trantor::EventLoop *loop, bool purgeDatabase) {
+    purgeDatabase_ = purgeDatabase;
+    loop->runEvery(60.0, [this]() { sweep(); });
+}
+
+// Логин не содержит '/', поэтому ключи разных пользователей не
+// пересекаются.
+static std::string entryId(const std::string &login, const std::string &key) {
+    return login + '/' + key;
+}
+
+void IdempotencyStore::remember(const std::string &id, Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // При переполнении ключ остается только в базе.
+    if (entries_.size() >= maxEntries_ && !entries_.count(id)) {
+        return;
+    }
+    entries_[id] = std::move(entry);
+}
+
+drogon::Task<IdempotencyStore::Result> IdempotencyStore::claim(
+    TimedDbClientPtr db,
+    std::string login,
+    std::string key,
+    std::string fingerprint
+) {
+    auto id = entryId(login, key);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(id);
+        if (it != entries_.end() && it->second.expires > Clock::now()) {
+            if (it->second.fingerprint != fingerprint) {
+                ++mismatches_;
+                co_return Result{Status::Mismatch, {}};
+            }
+            if (it->second.response.empty()) {
+                ++inProgress_;
+                co_return Result{Status::InProgress, {}};
+            }
+            ++memoryReplays_;
+            co_return Result{Status::Replay, it->second.response};
+        }
+    }
+
+    // Ключ захватывается вставкой; истекший или брошенный захват
+    // перезаписывается. Строка k — снимок до вставки, она нужна, только
+    // если захватить ключ не удалось.
+    static const std::string sql = R"sql(
+        WITH claimed AS (
+            INSERT INTO idempotency_keys (login, idem_key, fingerprint)
+            VALUES ($1, $2, $3)
+            ON CONFLICT (login, idem_key) DO UPDATE SET
+                fingerprint = EXCLUDED.fingerprint,
+                response = NULL,
+                created_at = now()
+            WHERE idempotency_keys.created_at <
+                      now() - make_interval(secs => $4::double precision)
+               OR (idempotency_keys.response IS NULL AND
+                   idempotency_keys.created_at <
+                      now() - make_interval(secs => $5::double precision))
+            RETURNING 1
+        )
+        SELECT EXISTS (SELECT 1 FROM claimed) AS claimed,
+               k.fingerprint, k.response
+        FROM (SELECT 1) AS one
+        LEFT JOIN idempotency_keys k ON k.login = $1 AND k.idem_key = $2
+    )sql";
+    auto expires = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(ttlSec_)
+                                  );
+    auto r = co_await db->execSqlCoro(
+        sql, login, key, fingerprint, std::to_string(ttlSec_),
+        std::to_string(inFlightTimeoutSec_)
+    );
+    const auto &row = r[0];
+    if (row["claimed"].as<bool>()) {
+        ++claims_;
+        remember(id, Entry{std::move(fingerprint), {}, expires});
+        co_return Result{Status::Owned, {}};
+    }
+    // Строки нет в снимке: ключ только что захватил параллельный запрос.
+    if (row["fingerprint"].isNull() || row["response"].isNull()) {
+        ++inProgress_;
+        co_return Result{Status::InProgress, {}};
+    }
+    if (row["fingerprint"].as<std::string>() != fingerprint) {
+        ++mismatches_;
+        co_return Result{Status::Mismatch, {}};
+    }
+    ++dbReplays_;
+    auto response = row["response"].as<std::string>();
+    remember(id, Entry{std::move(fingerprint), response, expires});
+    co_return Result{Status::Replay, std::move(response)};
+}
+
+void IdempotencyStore::complete(
+    const TimedDbClientPtr &db,
+    const std::string &login,
+    const std::string &key,
+    const std::string &response
+) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(entryId(login, key));
+        if (it != entries_.end()) {
+            it->second.response = response;
+        }
+    }
+    db->execSqlAsync(
+        R"sql(UPDATE idempotency_keys SET response = $3 WHERE login = $1 AND idem_key = $2)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << "idempotency response not saved: " << e.base().what();
+        },
+        login, key, response
+    );
+}
+
+void IdempotencyStore::release(
+    const TimedDbClientPtr &db,
+    const std::string &login,
+    const std::string &key
+) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(entryId(login, key));
+    }
+    db->execSqlAsync(
+        R"sql(DELETE FROM idempotency_keys WHERE login = $1 AND idem_key = $2 AND response IS NULL)sql",
+        [](const drogon::orm::Result &) {},
+        [](const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << "idempotency key not released: " << e.base().what();
+        },
+        login, key
+    );
+}
+
+void IdempotencyStore::sweep() {
+    auto now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::erase_if(entries_, [&](const auto &item) {
+            return item.second.expires <= now;
+        });
+    }
+    if (!purgeDatabase_) {
+        return;
+    }
+    for (const auto &db : ShardRouter::instance().primaries()) {
+        db->execSqlAsync(
+            R"sql(DELETE FROM idempotency_keys WHERE created_at < now() - make_interval(secs => $1::double precision))sql",
+            [](const drogon::orm::Result &) {},
+            [](const drogon::orm::DrogonDbException &e) {
+                LOG_ERROR << e.base().what();
+            },
+            std::to_string(ttlSec_)
+        );
+    }
+}
+
+Json::Value IdempotencyStore::stats() const {
+    Json::Value ret;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ret["entries"] = (Json::UInt64)entries_.size();
+    }
+    ret["claims"] = (Json::UInt64)claims_.load();
+    ret["memoryReplays"] = (Json::UInt64)memoryReplays_.load();
+    ret["dbReplays"] = (Json::UInt64)dbReplays_.load();
+    ret["inProgress"] = (Json::UInt64)inProgress_.load();
+    ret["mismatches"] = (Json::UInt64)mismatches_.load();
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+#include <drogon/utils/coroutine.h>
+#include <trantor/net/EventLoop.h>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "db/TimedDbClient.h"
+
+// Результаты запросов с заголовком Idempotency-Key. Первый запрос
+// захватывает ключ в таблице idempotency_keys на шарде пользователя,
+// повтор получает сохраненный ответ без повторной записи поста и
+// картинок. Память — кеш перед таблицей: повтор, пришедший в другой
+// процесс или после рестарта, находит ответ в базе. Ключи живут ttl_sec;
+// захват без ответа дольше in_flight_timeout_sec считается брошенным.
+class IdempotencyStore {
+public:
+    enum class Status {
+        // Ключ захвачен этим запросом, его нужно завершить complete или
+        // release.
+        Owned,
+        // Запрос уже выполнен, response — сохраненное тело ответа.
+        Replay,
+        // Тот же ключ обрабатывается прямо сейчас.
+        InProgress,
+        // Ключ уже использован с другим телом запроса.
+        Mismatch
+    };
+
+    struct Result {
+        Status status;
+        std::string response;
+    };
+
+    static IdempotencyStore &instance();
+
+    void configure(const Json::Value &config);
+    // Просроченные ключи удаляются из памяти в каждом процессе, а из
+    // базы — только если purgeDatabase.
+    void start(trantor::EventLoop *loop, bool purgeDatabase);
+
+    drogon::Task<Result> claim(
+        TimedDbClientPtr db,
+        std::string login,
+        std::string key,
+        std::string fingerprint
+    );
+    void complete(
+        const TimedDbClientPtr &db,
+        const std::string &login,
+        const std::string &key,
+        const std::string &response
+    );
+    // Снимает захват после ошибки, чтобы клиент мог повторить запрос.
+    void release(
+        const TimedDbClientPtr &db,
+        const std::string &login,
+        const std::string &key
+    );
+
+    Json::Value stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string fingerprint;
+        // Пустой, пока запрос выполняется.
+        std::string response;
+        Clock::time_point expires;
+    };
+
+    IdempotencyStore() = default;
+
+    void remember(const std::string &id, Entry entry);
+    void sweep();
+
+    bool purgeDatabase_ = true;
+    double ttlSec_ = 86400;
+    double inFlightTimeoutSec_ = 60;
+    size_t maxEntries_ = 100000;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+
+    std::atomic<uint64_t> claims_{0};
+    std::atomic<uint64_t> memoryReplays_{0};
+    std::atomic<uint64_t> dbReplays_{0};
+    std::atomic<uint64_t> inProgress_{0};
+    std::atomic<uint64_t> mismatches_{0};
+};
@@ -0,0 +1,138 @@
+#include "MediaStore.h"
+#include <drogon/drogon.h>
+#include <drogon/utils/Utilities.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+MediaStore &MediaStore::instance() {
+    static MediaStore store;
+    return store;
+}
+
+void MediaStore::configure(const Json::Value &config) {
+    dir_ = config.get("dir", dir_).asString();
+    if (!dir_.empty() && dir_.back() != '/') {
+        dir_ += '/';
+    }
+}
+
+std::string MediaStore::pathFor(const std::string &hash) const {
+    // Два уровня каталогов по 256 штук, чтобы в одном каталоге не копились
+    // миллионы файлов.
+    return dir_ + hash.substr(0, 2) + '/' + hash.substr(2, 2) + '/' + hash +
+           ".jpg";
+}
+
+// Запись с fsync до закрытия: после rename на диске не может оказаться
+// файл с новым именем и недописанным содержимым.
+static bool writeFileSynced(const std::string &path, const std::string &bytes) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR << "Failed to open " << path << ": " << std::strerror(errno);
+        return false;
+    }
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n =
+            ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            LOG_ERROR << "Failed to write " << path << ": "
+                      << std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        written += n;
+    }
+    if (::fsync(fd) != 0) {
+        LOG_ERROR << "Failed to fsync " << path << ": " << std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    return ::close(fd) == 0;
+}
+
+// Сам rename становится долговечным только после fsync каталога.
+static bool syncDirectory(const std::filesystem::path &dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+std::optional<MediaStore::Stored> MediaStore::put(const std::string &base64) {
+    std::string bytes = drogon::utils::base64Decode(base64);
+    if (bytes.empty()) {
+        LOG_ERROR << "Failed to decode base64 image";
+        ++failures_;
+        return std::nullopt;
+    }
+    std::string hash = drogon::utils::getSha256(bytes.data(), bytes.size());
+    std::transform(hash.begin(), hash.end(), hash.begin(), ::tolower);
+    std::string path = pathFor(hash);
+
+    // Файл с тем же hash считается той же картинкой, только если совпадает
+    // и размер: обрезанный после сбоя файл перезаписывается.
+    std::error_code ec;
+    auto existingSize = std::filesystem::file_size(path, ec);
+    if (!ec && existingSize == bytes.size()) {
+        ++deduplicated_;
+        return Stored{std::move(hash), std::move(path), true};
+    }
+    ec.clear();
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), ec
+    );
+    if (ec) {
+        LOG_ERROR << "Failed to create media directory for " << path << ": "
+                  << ec.message();
+        ++failures_;
+        return std::nullopt;
+    }
+
+    // Файл пишется под временным именем и переименовывается: читатель
+    // никогда не увидит недописанную картинку. Имя уникально для процесса
+    // и потока, а внутри потока put не прерывается.
+    std::string tmp =
+        path + ".tmp." + std::to_string(::getpid()) + '.' +
+        std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    if (!writeFileSynced(tmp, bytes)) {
+        std::filesystem::remove(tmp, ec);
+        ++failures_;
+        return std::nullopt;
+    }
+    // Если ту же картинку параллельно записал другой процесс, rename
+    // заменит файл идентичным содержимым.
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        LOG_ERROR << "Failed to rename " << tmp << " to " << path << ": "
+                  << ec.message();
+        std::filesystem::remove(tmp, ec);
+        ++failures_;
+        return std::nullopt;
+    }
+    if (!syncDirectory(std::filesystem::path(path).parent_path())) {
+        LOG_WARN << "Failed to fsync media directory for " << path;
+    }
+    ++writes_;
+    return Stored{std::move(hash), std::move(path), false};
+}
+
+Json::Value MediaStore::stats() const {
+    Json::Value ret;
+    ret["writes"] = (Json::UInt64)writes_.load();
+    ret["deduplicated"] = (Json::UInt64)deduplicated_.load();
+    ret["failures"] = (Json::UInt64)failures_.load();
+    return ret;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <json/json.h>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Картинки хранятся по SHA-256 содержимого: <dir>/ab/cd/<hash>.jpg.
+// Одинаковые картинки лежат на диске один раз, ссылками на файл служат
+// строки media с тем же hash, их число и есть счетчик ссылок.
+class MediaStore {
+public:
+    struct Stored {
+        std::string hash;
+        std::string path;
+        // Файл уже был на диске, записи не было.
+        bool deduplicated;
+    };
+
+    static MediaStore &instance();
+
+    void configure(const Json::Value &config);
+
+    // Декодирует base64 и сохраняет картинку, если такой еще нет.
+    // std::nullopt, если данные пустые или файл не удалось записать.
+    std::optional<Stored> put(const std::string &base64);
+
+    std::string pathFor(const std::string &hash) const;
+
+    Json::Value stats() const;
+
+private:
+    std::string dir_ = "../media/";
+    std::atomic<uint64_t> writes_{0};
+    std::atomic<uint64_t> deduplicated_{0};
+    std::atomic<uint64_t> failures_{0};
+};
@@ -0,0 +1,144 @@
+#include "PostCache.h"
+#include "helpers.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+PostCache &PostCache::instance() {
+    static PostCache cache;
+    return cache;
+}
+
+PostCache::PostCache() {
+    configure(Json::Value());
+}
+
+void PostCache::configure(const Json::Value &config) {
+    size_t maxBytes =
+        config.get("max_bytes", (Json::UInt64)256 * 1024 * 1024).asUInt64();
+    size_t segments =
+        std::max<Json::UInt64>(1, config.get("segments", 16).asUInt64());
+    segmentBudget_ = maxBytes / segments;
+    segments_.clear();
+    for (size_t i = 0; i < segments; ++i) {
+        segments_.push_back(std::make_unique<Segment>());
+    }
+}
+
+PostCache::Segment &PostCache::segmentFor(const std::string &uuid) {
+    return *segments_[std::hash<std::string>{}(uuid) % segments_.size()];
+}
+
+size_t PostCache::entryBytes(const Entry &entry) {
+    return entry.uuid.size() + entry.fragment->size() + sizeof(Entry);
+}
+
+void PostCache::erase(Segment &segment, std::list<Entry>::iterator it) {
+    segment.bytes -= entryBytes(*it);
+    segment.index.erase(it->uuid);
+    segment.lru.erase(it);
+}
+
+PostCache::Fragment PostCache::get(const std::string &uuid, int64_t version) {
+    auto &segment = segmentFor(uuid);
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    auto found = segment.index.find(uuid);
+    if (found == segment.index.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    auto it = found->second;
+    if (it->version != version) {
+        erase(segment, it);
+        ++misses_;
+        return nullptr;
+    }
+    segment.lru.splice(segment.lru.begin(), segment.lru, it);
+    ++hits_;
+    return it->fragment;
+}
+
+void PostCache::put(
+    const std::string &uuid,
+    int64_t version,
+    Fragment fragment
+) {
+    Entry entry{uuid, version, std::move(fragment)};
+    size_t bytes = entryBytes(entry);
+    // Пост с крупными картинками вытеснил бы весь сегмент.
+    if (bytes > segmentBudget_ / 4) {
+        return;
+    }
+    auto &segment = segmentFor(uuid);
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    auto found = segment.index.find(uuid);
+    if (found != segment.index.end()) {
+        erase(segment, found->second);
+    }
+    segment.lru.push_front(std::move(entry));
+    segment.index.emplace(uuid, segment.lru.begin());
+    segment.bytes += bytes;
+    while (segment.bytes > segmentBudget_) {
+        erase(segment, std::prev(segment.lru.end()));
+        ++evictions_;
+    }
+}
+
+PostCache::Fragment PostCache::fragment(const drogon::orm::Row &row) {
+    auto uuid = row["id_uuid"].as<std::string>();
+    auto version = row["version"].as<int64_t>();
+    if (auto cached = get(uuid, version)) {
+        return cached;
+    }
+
+    Json::Value post;
+    post["id"] = uuid;
+    post["content"] = row["content"].as<std::string>();
+    post["author"] = row["author"].as<std::string>();
+
+    forEachListItem(row["tags1"].as<std::string>(), [&](std::string_view tag) {
+        post["tags"].append(std::string(tag));
+    });
+
+    forEachListItem(
+        row["images"].as<std::string>(),
+        [&](std::string_view imgPath) {
+            std::string base64 = loadImageAsBase64(std::string(imgPath));
+            if (!base64.empty()) {
+                post["img"].append(std::move(base64));
+            }
+        }
+    );
+
+    post["createdAt"] = formatIsoTimestampUs(createdAtUs(row));
+
+    static const Json::StreamWriterBuilder writer = [] {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        return builder;
+    }();
+    auto json = Json::writeString(writer, post);
+    json.pop_back();
+    auto fragment = std::make_shared<const std::string>(std::move(json));
+    put(uuid, version, fragment);
+    return fragment;
+}
+
+Json::Value PostCache::stats() const {
+    uint64_t entries = 0, bytes = 0;
+    for (const auto &segment : segments_) {
+        std::lock_guard<std::mutex> lock(segment->mutex);
+        entries += segment->lru.size();
+        bytes += segment->bytes;
+    }
+    uint64_t hits = hits_.load(), misses = misses_.load();
+    Json::Value ret;
+    ret["entries"] = (Json::UInt64)entries;
+    ret["bytes"] = (Json::UInt64)bytes;
+    ret["budget"] = (Json::UInt64)(segmentBudget_ * segments_.size());
+    ret["hits"] = (Json::UInt64)hits;
+    ret["misses"] = (Json::UInt64)misses;
+    ret["hitRate"] = hits + misses ? (double)hits / (hits + misses) : 0.0;
+    ret["evictions"] = (Json::UInt64)evictions_.load();
+    return ret;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <drogon/orm/Row.h>
+#include <json/json.h>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Кеш сериализованных в JSON постов. Ключ — id_uuid и posts.version: любое
+// изменение поста обязано увеличить version, и старый фрагмент перестает
+// совпадать. Счетчики реакций во фрагмент не входят и дописываются из
+// строки запроса, поэтому лайки кеш не инвалидируют. Кеш разбит на
+// сегменты со своей блокировкой и LRU, общий объем ограничен max_bytes.
+class PostCache {
+public:
+    using Fragment = std::shared_ptr<const std::string>;
+
+    static PostCache &instance();
+
+    void configure(const Json::Value &config);
+
+    // JSON поста без счетчиков реакций и без закрывающей скобки. Теги и
+    // картинки разбираются только при промахе. Строка должна содержать
+    // id_uuid, version, content, author, created_at_us, tags1 и images.
+    Fragment fragment(const drogon::orm::Row &row);
+
+    Fragment get(const std::string &uuid, int64_t version);
+    void put(const std::string &uuid, int64_t version, Fragment fragment);
+
+    Json::Value stats() const;
+
+private:
+    struct Entry {
+        std::string uuid;
+        int64_t version;
+        Fragment fragment;
+    };
+
+    struct Segment {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    PostCache();
+
+    Segment &segmentFor(const std::string &uuid);
+    static size_t entryBytes(const Entry &entry);
+    void erase(Segment &segment, std::list<Entry>::iterator it);
+
+    size_t segmentBudget_ = 0;
+    std::vector<std::unique_ptr<Segment>> segments_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
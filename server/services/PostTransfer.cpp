@@ -0,0 +1,408 @@
+#include "PostTransfer.h"
+#include <drogon/drogon.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "db/ShardRouter.h"
+
+namespace {
+
+using PgConnPtr = std::unique_ptr<PGconn, void (*)(PGconn *)>;
+using PgResultPtr = std::unique_ptr<PGresult, void (*)(PGresult *)>;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - start
+    )
+        .count();
+}
+
+PgConnPtr connect(const std::string &connectionString, std::string &error) {
+    PgConnPtr conn(PQconnectdb(connectionString.c_str()), PQfinish);
+    if (PQstatus(conn.get()) != CONNECTION_OK) {
+        error = PQerrorMessage(conn.get());
+        conn.reset();
+    }
+    return conn;
+}
+
+bool exec(PGconn *conn, const char *sql, ExecStatusType expected,
+          std::string &error) {
+    PgResultPtr r(PQexec(conn, sql), PQclear);
+    if (PQresultStatus(r.get()) != expected) {
+        error = PQerrorMessage(conn);
+        return false;
+    }
+    return true;
+}
+
+// Результат COPY приходит после конца данных; остальные читаются до nullptr,
+// иначе соединение останется занятым.
+bool finishCopy(PGconn *conn, std::string &error) {
+    bool ok = true;
+    while (PGresult *r = PQgetResult(conn)) {
+        if (PQresultStatus(r) != PGRES_COMMAND_OK) {
+            error = PQresultErrorMessage(r);
+            ok = false;
+        }
+        PQclear(r);
+    }
+    return ok;
+}
+
+// Текстовый формат COPY экранирует обратный слеш и управляющие символы.
+// В JSON управляющих символов нет, но разбирается весь формат.
+void unescapeCopyText(const char *data, size_t size, std::string &out) {
+    out.clear();
+    for (size_t i = 0; i < size; ++i) {
+        char c = data[i];
+        if (c != '\\' || i + 1 == size) {
+            out.push_back(c);
+            continue;
+        }
+        switch (data[++i]) {
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'v':
+                out.push_back('\v');
+                break;
+            default:
+                out.push_back(data[i]);
+                break;
+        }
+    }
+}
+
+void escapeCopyText(const std::string &line, std::string &out) {
+    out.clear();
+    for (char c : line) {
+        switch (c) {
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            default:
+                out.push_back(c);
+                break;
+        }
+    }
+    out.push_back('\n');
+}
+
+const char *const kImportInsertSql = R"sql(
+    WITH src AS (
+        SELECT DISTINCT ON ((doc->>'id')::uuid) (doc->>'id')::uuid AS id_uuid, doc
+        FROM post_import
+        WHERE char_length(doc->>'content') <= 1000
+    ),
+    ins AS (
+        INSERT INTO posts (id_uuid, content, author, created_at)
+        SELECT id_uuid, doc->>'content', doc->>'author',
+               from_epoch_us((doc->>'createdAt')::bigint)
+        FROM src
+        ON CONFLICT (id_uuid) DO NOTHING
+        RETURNING id, id_uuid
+    ),
+    tagged AS (
+        INSERT INTO tags (id_post, tag)
+        SELECT ins.id, t.tag
+        FROM ins JOIN src USING (id_uuid),
+             jsonb_array_elements_text(COALESCE(src.doc->'tags', '[]')) AS t(tag)
+        WHERE char_length(t.tag) BETWEEN 1 AND 20
+    )
+    SELECT count(*) FROM ins)sql";
+
+}  // namespace
+
+Json::Value PostTransfer::Report::toJson() const {
+    Json::Value ret;
+    ret["rows"] = (Json::UInt64)rows;
+    ret["inserted"] = (Json::UInt64)inserted;
+    ret["skipped"] = (Json::UInt64)skipped;
+    ret["bytes"] = (Json::UInt64)bytes;
+    ret["seconds"] = seconds;
+    ret["rowsPerSecond"] = rowsPerSecond();
+    if (!error.empty()) {
+        ret["error"] = error;
+    }
+    return ret;
+}
+
+PostTransfer::Export::Export(
+    std::vector<std::string> connectionStrings,
+    std::string author
+)
+    : connectionStrings_(std::move(connectionStrings)),
+      author_(std::move(author)),
+      started_(std::chrono::steady_clock::now()) {
+    if (author_.empty()) {
+        for (size_t i = 0; i < connectionStrings_.size(); ++i) {
+            shards_.push_back(i);
+        }
+    } else {
+        shards_.push_back(
+            ShardRouter::shardOf(author_, connectionStrings_.size())
+        );
+    }
+}
+
+PostTransfer::Export::~Export() {
+    if (conn_ && !done_) {
+        // Клиент ушел посреди выгрузки: без отмены PQfinish ждал бы, пока
+        // сервер допишет COPY в закрытый сокет.
+        if (PGcancel *cancel = PQgetCancel(conn_.get())) {
+            char buffer[256];
+            PQcancel(cancel, buffer, sizeof(buffer));
+            PQfreeCancel(cancel);
+        }
+        report_.error = "export interrupted";
+    }
+    report_.seconds = secondsSince(started_);
+    PostTransfer::instance().record("export", report_);
+}
+
+bool PostTransfer::Export::openShard(size_t shard) {
+    std::string error;
+    conn_ = connect(connectionStrings_[shard], error);
+    if (!conn_) {
+        fail(error);
+        return false;
+    }
+    std::string sql = R"sql(
+        COPY (
+            SELECT json_build_object(
+                'id', p.id_uuid,
+                'author', p.author,
+                'content', p.content,
+                'createdAt', epoch_us(p.created_at),
+                'tags', COALESCE(
+                    (SELECT json_agg(t.tag ORDER BY t.id) FROM tags t WHERE t.id_post = p.id),
+                    '[]'::json
+                )
+            )
+            FROM posts p)sql";
+    if (!author_.empty()) {
+        // У COPY нет параметров запроса.
+        char *literal =
+            PQescapeLiteral(conn_.get(), author_.data(), author_.size());
+        if (!literal) {
+            fail(PQerrorMessage(conn_.get()));
+            return false;
+        }
+        sql += " WHERE p.author = ";
+        sql += literal;
+        PQfreemem(literal);
+    }
+    sql += " ORDER BY p.id) TO STDOUT";
+    if (!exec(conn_.get(), sql.c_str(), PGRES_COPY_OUT, error)) {
+        fail(error);
+        return false;
+    }
+    return true;
+}
+
+void PostTransfer::Export::fail(const std::string &error) {
+    report_.error = error;
+    done_ = true;
+    conn_.reset();
+}
+
+bool PostTransfer::Export::nextRow() {
+    while (!done_) {
+        if (!conn_) {
+            if (next_ == shards_.size()) {
+                done_ = true;
+                break;
+            }
+            if (!openShard(shards_[next_++])) {
+                break;
+            }
+        }
+        char *row = nullptr;
+        int size = PQgetCopyData(conn_.get(), &row, 0);
+        if (size > 0) {
+            unescapeCopyText(row, size, pending_);
+            PQfreemem(row);
+            offset_ = 0;
+            ++report_.rows;
+            report_.bytes += pending_.size();
+            return true;
+        }
+        std::string error;
+        if (size == -1 && finishCopy(conn_.get(), error)) {
+            conn_.reset();
+            continue;
+        }
+        fail(size == -1 ? error : PQerrorMessage(conn_.get()));
+    }
+    return false;
+}
+
+size_t PostTransfer::Export::read(char *buffer, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        if (offset_ == pending_.size() && !nextRow()) {
+            break;
+        }
+        size_t n = std::min(size - written, pending_.size() - offset_);
+        std::memcpy(buffer + written, pending_.data() + offset_, n);
+        offset_ += n;
+        written += n;
+    }
+    return written;
+}
+
+PostTransfer &PostTransfer::instance() {
+    static PostTransfer transfer;
+    return transfer;
+}
+
+PostTransfer::Report PostTransfer::importPosts(
+    const std::vector<std::string> &connectionStrings,
+    std::istream &in
+) {
+    auto started = std::chrono::steady_clock::now();
+    Report report;
+    std::vector<PgConnPtr> conns;
+    for (size_t i = 0; i < connectionStrings.size(); ++i) {
+        conns.emplace_back(nullptr, PQfinish);
+    }
+
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    std::string line, escaped, errors;
+    while (report.error.empty() && std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        Json::Value doc;
+        if (!reader->parse(line.data(), line.data() + line.size(), &doc,
+                           &errors) ||
+            !doc.isObject() || !doc["id"].isString() ||
+            doc["id"].asString().size() != 36 || !doc["author"].isString() ||
+            doc["author"].asString().empty() ||
+            doc["author"].asString().size() > 30 ||
+            !doc["content"].isString() || !doc["createdAt"].isInt64()) {
+            ++report.skipped;
+            continue;
+        }
+        auto author = doc["author"].asString();
+        size_t shard = ShardRouter::shardOf(author, conns.size());
+        // Пост с меткой другого шарда не нашелся бы по id.
+        auto tag = ShardRouter::shardTag(doc["id"].asString());
+        if (tag && *tag != shard) {
+            ++report.skipped;
+            continue;
+        }
+
+        auto &conn = conns[shard];
+        if (!conn) {
+            conn = connect(connectionStrings[shard], report.error);
+            if (!conn ||
+                !exec(conn.get(), "BEGIN", PGRES_COMMAND_OK, report.error) ||
+                !exec(conn.get(),
+                      "CREATE TEMP TABLE post_import (doc JSONB) ON COMMIT DROP",
+                      PGRES_COMMAND_OK, report.error) ||
+                !exec(conn.get(), "COPY post_import (doc) FROM STDIN",
+                      PGRES_COPY_IN, report.error)) {
+                conn.reset();
+                break;
+            }
+        }
+        escapeCopyText(line, escaped);
+        if (PQputCopyData(conn.get(), escaped.data(), escaped.size()) != 1) {
+            report.error = PQerrorMessage(conn.get());
+            break;
+        }
+        ++report.rows;
+        report.bytes += line.size() + 1;
+    }
+
+    for (auto &conn : conns) {
+        if (!conn) {
+            continue;
+        }
+        if (!report.error.empty()) {
+            // Прерванный COPY откатывает транзакцию на всех шардах.
+            PQputCopyEnd(conn.get(), "import aborted");
+            std::string ignored;
+            finishCopy(conn.get(), ignored);
+            continue;
+        }
+        std::string error;
+        if (PQputCopyEnd(conn.get(), nullptr) != 1 ||
+            !finishCopy(conn.get(), error)) {
+            report.error = error.empty() ? PQerrorMessage(conn.get()) : error;
+            continue;
+        }
+        PgResultPtr r(PQexec(conn.get(), kImportInsertSql), PQclear);
+        if (PQresultStatus(r.get()) != PGRES_TUPLES_OK ||
+            !exec(conn.get(), "COMMIT", PGRES_COMMAND_OK, error)) {
+            report.error = error.empty() ? PQerrorMessage(conn.get()) : error;
+            continue;
+        }
+        report.inserted += std::strtoull(PQgetvalue(r.get(), 0, 0), nullptr, 10);
+    }
+    report.seconds = secondsSince(started);
+    record("import", report);
+    return report;
+}
+
+void PostTransfer::record(const std::string &kind, const Report &report) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (kind == "export") {
+            ++exports_;
+            exportedRows_ += report.rows;
+            lastExport_ = report;
+        } else {
+            ++imports_;
+            importedRows_ += report.inserted;
+            lastImport_ = report;
+        }
+    }
+    if (report.error.empty()) {
+        LOG_INFO << "post " << kind << ": " << report.rows << " rows in "
+                 << report.seconds << " s, " << (uint64_t)report.rowsPerSecond()
+                 << " rows/s";
+    } else {
+        LOG_ERROR << "post " << kind << " failed after " << report.rows
+                  << " rows: " << report.error;
+    }
+}
+
+Json::Value PostTransfer::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Json::Value ret;
+    ret["exports"] = (Json::UInt64)exports_;
+    ret["imports"] = (Json::UInt64)imports_;
+    ret["exportedRows"] = (Json::UInt64)exportedRows_;
+    ret["importedRows"] = (Json::UInt64)importedRows_;
+    ret["lastExport"] = lastExport_.toJson();
+    ret["lastImport"] = lastImport_.toJson();
+    return ret;
+}
\ No newline at end of file
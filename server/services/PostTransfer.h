@@ -0,0 +1,91 @@
+#pragma once
+#include <json/json.h>
+#include <libpq-fe.h>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Выгрузка и загрузка постов в NDJSON через COPY ... TO STDOUT и
+// COPY ... FROM STDIN. В DbClient Drogon нет COPY, поэтому каждая операция
+// открывает свое соединение libpq к шарду. Строки идут потоком, память не
+// зависит от числа постов. Строка NDJSON:
+//   {"id": uuid, "author": login, "content": text,
+//    "createdAt": мкс от эпохи, "tags": [text, ...]}
+// Картинки не переносятся: они лежат в MediaStore, а не в базе.
+class PostTransfer {
+public:
+    struct Report {
+        uint64_t rows = 0;
+        uint64_t inserted = 0;
+        uint64_t skipped = 0;
+        uint64_t bytes = 0;
+        double seconds = 0;
+        std::string error;
+
+        double rowsPerSecond() const {
+            return seconds > 0 ? rows / seconds : 0;
+        }
+        Json::Value toJson() const;
+    };
+
+    // Выгрузка постов author (всех, если author пуст) как поток байтов.
+    // Соединения открываются лениво, шарды обходятся по очереди.
+    class Export {
+    public:
+        Export(std::vector<std::string> connectionStrings, std::string author);
+        ~Export();
+
+        // Заполняет buffer очередными строками; 0 — конец выгрузки или
+        // ошибка (см. report().error).
+        size_t read(char *buffer, size_t size);
+
+        const Report &report() const {
+            return report_;
+        }
+
+    private:
+        bool nextRow();
+        bool openShard(size_t shard);
+        void fail(const std::string &error);
+
+        std::vector<std::string> connectionStrings_;
+        std::string author_;
+        std::vector<size_t> shards_;
+        size_t next_ = 0;
+        std::unique_ptr<PGconn, void (*)(PGconn *)> conn_{nullptr, PQfinish};
+        std::string pending_;
+        size_t offset_ = 0;
+        bool done_ = false;
+        std::chrono::steady_clock::time_point started_;
+        Report report_;
+    };
+
+    static PostTransfer &instance();
+
+    // Читает NDJSON из in до конца. Строки раскладываются по шардам
+    // автора; на каждом шарде COPY идет во временную таблицу, откуда посты
+    // и теги вставляются одной транзакцией. Посты с уже существующим id
+    // пропускаются, поэтому повторная загрузка того же файла безопасна.
+    Report importPosts(
+        const std::vector<std::string> &connectionStrings,
+        std::istream &in
+    );
+
+    void record(const std::string &kind, const Report &report);
+    Json::Value stats() const;
+
+private:
+    PostTransfer() = default;
+
+    mutable std::mutex mutex_;
+    uint64_t exports_ = 0;
+    uint64_t imports_ = 0;
+    uint64_t exportedRows_ = 0;
+    uint64_t importedRows_ = 0;
+    Report lastExport_;
+    Report lastImport_;
+};
@@ -0,0 +1,108 @@
+#include "Profiler.h"
+#include <drogon/drogon.h>
+#include <unistd.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef PRIYOMYSH_PROFILER
+#include <gperftools/profiler.h>
+#endif
+#ifdef PRIYOMYSH_HEAP_PROFILE
+#include <gperftools/malloc_extension.h>
+#endif
+
+Profiler &Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::configure(const Json::Value &config) {
+    maxSeconds_ = config.get("max_seconds", maxSeconds_).asInt();
+    dir_ = config.get("dir", dir_).asString();
+}
+
+bool Profiler::cpuSupported() const {
+#ifdef PRIYOMYSH_PROFILER
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Profiler::cpuRunning() const {
+    return cpuRunning_;
+}
+
+bool Profiler::heapSupported() const {
+#ifdef PRIYOMYSH_HEAP_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Profiler::cpuProfile(int seconds, trantor::EventLoop *loop, Done done) {
+#ifdef PRIYOMYSH_PROFILER
+    if (cpuRunning_.exchange(true)) {
+        done(std::nullopt, "cpu profile is already running");
+        return;
+    }
+    seconds = std::clamp(seconds, 1, maxSeconds_);
+    // libprofiler пишет профиль только в файл.
+    auto path = dir_ + "/priyomysh-cpu-" + std::to_string(::getpid()) + ".prof";
+    if (!ProfilerStart(path.c_str())) {
+        cpuRunning_ = false;
+        ++failures_;
+        done(std::nullopt, "ProfilerStart failed");
+        return;
+    }
+    LOG_INFO << "CPU profile started for " << seconds << " s";
+    loop->runAfter(seconds, [this, path, done = std::move(done)]() {
+        ProfilerStop();
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream profile;
+        profile << file.rdbuf();
+        file.close();
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        cpuRunning_ = false;
+        if (profile.str().empty()) {
+            ++failures_;
+            done(std::nullopt, "cpu profile is empty");
+            return;
+        }
+        ++cpuProfiles_;
+        done(profile.str(), "");
+    });
+#else
+    (void)seconds;
+    (void)loop;
+    done(std::nullopt, "built without PRIYOMYSH_PROFILER");
+#endif
+}
+
+std::optional<std::string> Profiler::heapProfile(std::string &error) {
+#ifdef PRIYOMYSH_HEAP_PROFILE
+    std::string profile;
+    MallocExtension::instance()->GetHeapSample(&profile);
+    ++heapProfiles_;
+    return profile;
+#else
+    error = "built without PRIYOMYSH_ALLOCATOR=tcmalloc";
+    return std::nullopt;
+#endif
+}
+
+Json::Value Profiler::stats() const {
+    Json::Value ret;
+    ret["cpuSupported"] = cpuSupported();
+    ret["heapSupported"] = heapSupported();
+    ret["cpuRunning"] = cpuRunning_.load();
+    ret["cpuProfiles"] = (Json::UInt64)cpuProfiles_;
+    ret["heapProfiles"] = (Json::UInt64)heapProfiles_;
+    ret["failures"] = (Json::UInt64)failures_;
+    ret["maxSeconds"] = maxSeconds_;
+    return ret;
+}
\ No newline at end of file
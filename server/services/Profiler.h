@@ -0,0 +1,51 @@
+#pragma once
+#include <json/json.h>
+#include <trantor/net/EventLoop.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+// Профили живого процесса в формате pprof, см. /api/debug/pprof/*.
+// CPU-профиль снимает libprofiler из gperftools (сборка с
+// PRIYOMYSH_PROFILER=ON): таймер SIGPROF заводится только на время
+// профиля, без запроса профилировщик ничего не стоит. Профиль кучи — это
+// выборка живых выделений tcmalloc (PRIYOMYSH_ALLOCATOR=tcmalloc, частота
+// выборки задается TCMALLOC_SAMPLE_PARAMETER при запуске).
+//
+//   curl -H "X-Debug-Token: $T" 'host:8080/api/debug/pprof/profile?seconds=30' > cpu.prof
+//   pprof -http=: drogon_app cpu.prof
+class Profiler {
+public:
+    using Done = std::function<void(std::optional<std::string> profile,
+                                    const std::string &error)>;
+
+    static Profiler &instance();
+
+    void configure(const Json::Value &config);
+
+    bool cpuSupported() const;
+    bool cpuRunning() const;
+    bool heapSupported() const;
+
+    // Профилирует весь процесс seconds секунд (не больше max_seconds) и
+    // вызывает done в loop. Одновременно идет только один CPU-профиль:
+    // профилировщик gperftools глобален для процесса.
+    void cpuProfile(int seconds, trantor::EventLoop *loop, Done done);
+
+    std::optional<std::string> heapProfile(std::string &error);
+
+    Json::Value stats() const;
+
+private:
+    Profiler() = default;
+
+    int maxSeconds_ = 60;
+    std::string dir_ = "/tmp";
+
+    std::atomic<bool> cpuRunning_{false};
+    std::atomic<uint64_t> cpuProfiles_{0};
+    std::atomic<uint64_t> heapProfiles_{0};
+    std::atomic<uint64_t> failures_{0};
+};
@@ -0,0 +1,199 @@
+#include "ReactionBuffer.h"
+#include <drogon/drogon.h>
+#include "db/ShardRouter.h"
+#include "helpers.h"
+
+ReactionBuffer &ReactionBuffer::instance() {
+    static ReactionBuffer buffer;
+    return buffer;
+}
+
+void ReactionBuffer::configure(const Json::Value &config) {
+    flushIntervalSec_ =
+        config.get("flush_interval_sec", flushIntervalSec_).asDouble();
+    maxBatch_ = config.get("max_batch", (Json::UInt64)maxBatch_).asUInt64();
+    maxAttempts_ = config.get("max_attempts", maxAttempts_).asUInt();
+}
+
+void ReactionBuffer::start(trantor::EventLoop *loop) {
+    loop->runEvery(flushIntervalSec_, [this]() { flush(); });
+}
+
+ReactionBuffer::Shard &ReactionBuffer::localShard() {
+    thread_local Shard *shard = nullptr;
+    if (!shard) {
+        std::lock_guard<std::mutex> lock(shardsMutex_);
+        shards_.push_back(std::make_unique<Shard>());
+        shard = shards_.back().get();
+    }
+    return *shard;
+}
+
+void ReactionBuffer::add(
+    const std::string &postUuid,
+    const std::string &login,
+    Value value
+) {
+    auto &shard = localShard();
+    Entry entry{postUuid, login, value, seq_.fetch_add(1)};
+    std::string key = postUuid + '/' + login;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.pending[std::move(key)] = std::move(entry);
+}
+
+void ReactionBuffer::flush() {
+    if (flushing_.exchange(true)) {
+        return;
+    }
+
+    // Один пользователь мог успеть отреагировать из разных потоков:
+    // побеждает последняя реакция.
+    std::unordered_map<std::string, Entry> merged;
+    {
+        std::lock_guard<std::mutex> lock(shardsMutex_);
+        for (auto &shard : shards_) {
+            std::unordered_map<std::string, Entry> pending;
+            {
+                std::lock_guard<std::mutex> shardLock(shard->mutex);
+                pending.swap(shard->pending);
+            }
+            for (auto &[key, entry] : pending) {
+                auto it = merged.find(key);
+                if (it == merged.end()) {
+                    merged.emplace(key, std::move(entry));
+                } else if (it->second.seq < entry.seq) {
+                    it->second = std::move(entry);
+                }
+            }
+        }
+    }
+    if (merged.empty()) {
+        flushing_ = false;
+        return;
+    }
+
+    // Реакция уходит на шард автора поста. Если шард не виден по uuid,
+    // реакция отправляется на все шарды: там, где поста нет, JOIN с posts
+    // ее отбросит.
+    auto &router = ShardRouter::instance();
+    std::vector<std::vector<std::vector<Entry>>> batches(router.count());
+    auto addTo = [&](size_t shard, Entry entry) {
+        auto &shardBatches = batches[shard];
+        if (shardBatches.empty() || shardBatches.back().size() >= maxBatch_) {
+            shardBatches.emplace_back();
+        }
+        shardBatches.back().push_back(std::move(entry));
+    };
+    for (auto &[key, entry] : merged) {
+        if (auto shard = router.shardOfPost(entry.postUuid)) {
+            addTo(*shard, std::move(entry));
+        } else {
+            for (size_t shard = 0; shard < router.count(); ++shard) {
+                addTo(shard, entry);
+            }
+        }
+    }
+
+    size_t total = 0;
+    for (const auto &shardBatches : batches) {
+        total += shardBatches.size();
+    }
+    auto remaining = std::make_shared<std::atomic<size_t>>(total);
+    for (size_t shard = 0; shard < batches.size(); ++shard) {
+        auto db = router.shard(shard).primary;
+        for (auto &batch : batches[shard]) {
+            // uuid и логины уже провалидированы, экранирование в литералах
+            // массивов не нужно.
+            std::string uuids = "{", logins = "{", values = "{", seqs = "{";
+            for (size_t i = 0; i < batch.size(); ++i) {
+                const char *sep = i + 1 < batch.size() ? "," : "}";
+                uuids += batch[i].postUuid + sep;
+                logins += batch[i].login + sep;
+                values += std::to_string(batch[i].value) + sep;
+                seqs += std::to_string(batch[i].seq) + sep;
+            }
+            auto entries =
+                std::make_shared<std::vector<Entry>>(std::move(batch));
+            // Один пост может прийти и по id_uuid, и по legacy_uuid: из
+            // таких строк остается последняя реакция, иначе ON CONFLICT
+            // задел бы одну строку дважды. Приращения считаются по
+            // prev_value, записанному тем же upsert под блокировкой строки,
+            // поэтому параллельные сбросы из разных процессов не
+            // расходятся.
+            db->execSqlAsync(
+                R"sql(
+                    WITH input AS (
+                        SELECT DISTINCT ON (p.id, i.login)
+                               p.id AS post_id, i.login, i.value
+                        FROM unnest($1::uuid[], $2::varchar[], $3::smallint[],
+                                    $4::bigint[])
+                             AS i(post_uuid, login, value, seq)
+                        JOIN posts p ON p.id_uuid = i.post_uuid
+                                     OR p.legacy_uuid = i.post_uuid
+                        JOIN users u ON u.login = p.author
+                        WHERE u.is_public = true OR p.author = i.login
+                        ORDER BY p.id, i.login, i.seq DESC
+                    ),
+                    upserted AS (
+                        INSERT INTO reactions (post_id, login, value, prev_value)
+                        SELECT post_id, login, value, 0 FROM input
+                        ON CONFLICT (post_id, login) DO UPDATE SET
+                            prev_value = reactions.value,
+                            value = EXCLUDED.value
+                        RETURNING post_id, value, prev_value
+                    ),
+                    deltas AS (
+                        SELECT post_id,
+                               SUM((value = 1)::int - (prev_value = 1)::int) AS likes,
+                               SUM((value = -1)::int - (prev_value = -1)::int) AS dislikes
+                        FROM upserted
+                        GROUP BY post_id
+                    )
+                    INSERT INTO post_reaction_counts (post_id, likes, dislikes)
+                    SELECT post_id, likes, dislikes FROM deltas
+                    ON CONFLICT (post_id) DO UPDATE SET
+                        likes = post_reaction_counts.likes + EXCLUDED.likes,
+                        dislikes = post_reaction_counts.dislikes + EXCLUDED.dislikes
+                )sql",
+                [this, remaining](const drogon::orm::Result &) {
+                    if (--*remaining == 0) {
+                        flushing_ = false;
+                    }
+                },
+                [this, remaining,
+                 entries](const drogon::orm::DrogonDbException &e) {
+                    LOG_ERROR << "reactions flush failed: "
+                              << e.base().what();
+                    // Возвращаем реакции в буфер, если пользователь не
+                    // успел поставить новую. После max_attempts неудач
+                    // пачка отбрасывается, чтобы не повторять ее вечно.
+                    auto &local = localShard();
+                    size_t dropped = 0;
+                    {
+                        std::lock_guard<std::mutex> lock(local.mutex);
+                        for (auto &entry : *entries) {
+                            if (++entry.attempts >= maxAttempts_) {
+                                ++dropped;
+                                continue;
+                            }
+                            std::string key =
+                                entry.postUuid + '/' + entry.login;
+                            local.pending.emplace(
+                                std::move(key), std::move(entry)
+                            );
+                        }
+                    }
+                    if (dropped > 0) {
+                        LOG_ERROR << "reactions dropped after "
+                                  << maxAttempts_ << " attempts: " << dropped;
+                    }
+                    if (--*remaining == 0) {
+                        flushing_ = false;
+                    }
+                },
+                std::move(uuids), std::move(logins), std::move(values),
+                std::move(seqs)
+            );
+        }
+    }
+}
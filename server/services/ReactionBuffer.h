@@ -0,0 +1,57 @@
+#pragma once
+#include <trantor/net/EventLoop.h>
+#include <json/json.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Лайки и дизлайки копятся в памяти по потокам и раз в flush_interval_sec
+// одним запросом записываются в reactions и post_reaction_counts. Так
+// популярный пост не превращается в горячую строку под UPDATE на каждый
+// клик.
+class ReactionBuffer {
+public:
+    enum Value : int16_t { None = 0, Like = 1, Dislike = -1 };
+
+    static ReactionBuffer &instance();
+
+    void configure(const Json::Value &config);
+    void start(trantor::EventLoop *loop);
+
+    // Повторная реакция пользователя на тот же пост заменяет предыдущую.
+    void add(const std::string &postUuid, const std::string &login, Value value);
+
+    void flush();
+
+private:
+    struct Entry {
+        std::string postUuid;
+        std::string login;
+        Value value;
+        uint64_t seq;
+        // Неудачных попыток записи.
+        unsigned attempts = 0;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> pending;
+    };
+
+    ReactionBuffer() = default;
+
+    Shard &localShard();
+
+    double flushIntervalSec_ = 1.0;
+    size_t maxBatch_ = 5000;
+    unsigned maxAttempts_ = 5;
+
+    std::mutex shardsMutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint64_t> seq_{0};
+    std::atomic<bool> flushing_{false};
+};
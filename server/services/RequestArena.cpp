@@ -0,0 +1,113 @@
+#include "RequestArena.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+#ifndef PRIYOMYSH_ALLOCATOR
+#define PRIYOMYSH_ALLOCATOR "system"
+#endif
+
+namespace {
+
+// Счетчики потока увеличиваются в operator new. Прямые вызовы malloc
+// (jsoncpp, libpq, сам Drogon) в них не попадают: перехват malloc
+// конфликтовал бы с подключаемым через PRIYOMYSH_ALLOCATOR аллокатором.
+// Полную картину дает bench/alloc_bench. У thread_local с
+// константной инициализацией нет ленивой инициализации, поэтому это
+// безопасно даже при старте и завершении потоков.
+thread_local uint64_t threadAllocations = 0;
+thread_local uint64_t threadBytes = 0;
+
+thread_local RequestArena *currentArena = nullptr;
+thread_local bool threadBufferInUse = false;
+constexpr size_t kThreadBufferSize = 64 * 1024;
+alignas(std::max_align_t) thread_local std::byte threadBuffer[kThreadBufferSize];
+
+struct RouteStats {
+    uint64_t requests = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+std::mutex statsMutex;
+std::unordered_map<std::string, RouteStats> routeStats;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+    ++threadAllocations;
+    threadBytes += size;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+RequestArena::RequestArena(const char *route)
+    : route_(route),
+      previous_(currentArena),
+      ownsBuffer_(!threadBufferInUse),
+      startAllocations_(threadAllocations),
+      startBytes_(threadBytes) {
+    if (ownsBuffer_) {
+        threadBufferInUse = true;
+        arena_.emplace(threadBuffer, kThreadBufferSize);
+    } else {
+        arena_.emplace();
+    }
+    currentArena = this;
+}
+
+RequestArena::~RequestArena() {
+    arena_.reset();
+    if (ownsBuffer_) {
+        threadBufferInUse = false;
+    }
+    currentArena = previous_;
+
+    uint64_t allocations = threadAllocations - startAllocations_;
+    uint64_t bytes = threadBytes - startBytes_;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    auto &stats = routeStats[route_];
+    ++stats.requests;
+    stats.allocations += allocations;
+    stats.bytes += bytes;
+}
+
+std::pmr::memory_resource *RequestArena::resource() {
+    if (currentArena) {
+        return &*currentArena->arena_;
+    }
+    return std::pmr::new_delete_resource();
+}
+
+Json::Value RequestArena::stats() {
+    Json::Value ret;
+    ret["allocator"] = PRIYOMYSH_ALLOCATOR;
+    ret["counted"] = "operator new";
+    Json::Value routes(Json::objectValue);
+    std::lock_guard<std::mutex> lock(statsMutex);
+    for (const auto &[route, stats] : routeStats) {
+        Json::Value stat;
+        stat["requests"] = (Json::UInt64)stats.requests;
+        stat["allocations"] = (Json::UInt64)stats.allocations;
+        stat["bytes"] = (Json::UInt64)stats.bytes;
+        stat["allocationsPerRequest"] =
+            stats.requests ? (double)stats.allocations / stats.requests : 0.0;
+        stat["bytesPerRequest"] =
+            stats.requests ? (double)stats.bytes / stats.requests : 0.0;
+        routes[route] = std::move(stat);
+    }
+    ret["routes"] = std::move(routes);
+    return ret;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <json/json.h>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+
+// Монотонная арена для мелких временных буферов запроса (разбор строк,
+// представления тегов). Крупные буферы вроде картинок сюда не кладутся:
+// арена не освобождает память до конца обработчика. Живет только на синхронном участке обработчика, без
+// co_await внутри: первые 64 КБ берутся из буфера потока, остальное из
+// кучи и освобождается целиком в деструкторе. Заодно считает выделения
+// через operator new за время жизни арены и копит их по маршруту; malloc
+// в библиотеках в эти счетчики не входит.
+class RequestArena {
+public:
+    explicit RequestArena(const char *route);
+    ~RequestArena();
+
+    RequestArena(const RequestArena &) = delete;
+    RequestArena &operator=(const RequestArena &) = delete;
+
+    // Арена текущего потока или обычная куча, если арены нет.
+    static std::pmr::memory_resource *resource();
+
+    static Json::Value stats();
+
+private:
+    const char *route_;
+    RequestArena *previous_;
+    bool ownsBuffer_;
+    uint64_t startAllocations_;
+    uint64_t startBytes_;
+    std::optional<std::pmr::monotonic_buffer_resource> arena_;
+};
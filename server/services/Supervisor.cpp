@@ -0,0 +1,529 @@
+#include "Supervisor.h"
+#include <drogon/drogon.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "db/SingleFlight.h"
+#include "services/AdmissionControl.h"
+#include "services/AsyncLog.h"
+#include "services/AvailabilityFilter.h"
+#include "services/FeedHub.h"
+#include "services/IdempotencyStore.h"
+#include "services/MediaStore.h"
+#include "services/PostCache.h"
+#include "services/PostTransfer.h"
+#include "services/TokenCache.h"
+
+namespace {
+
+// Воркер, упавший быстрее, перезапускается не сразу, чтобы ошибка в
+// конфигурации не превратилась в непрерывный fork.
+constexpr std::chrono::seconds kCrashBackoff{1};
+
+sigset_t supervisorSignals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    return mask;
+}
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()
+    )
+        .count();
+}
+
+// Складывает целые значения value в total с сохранением вложенности.
+void sumInto(Json::Value &total, const Json::Value &value) {
+    for (const auto &name : value.getMemberNames()) {
+        const auto &v = value[name];
+        if (v.isObject()) {
+            sumInto(total[name], v);
+        } else if (v.type() == Json::uintValue) {
+            total[name] = (Json::UInt64)(total[name].asUInt64() + v.asUInt64());
+        } else if (v.type() == Json::intValue) {
+            total[name] = (Json::Int64)(total[name].asInt64() + v.asInt64());
+        }
+    }
+}
+
+}  // namespace
+
+Supervisor &Supervisor::instance() {
+    static Supervisor supervisor;
+    return supervisor;
+}
+
+void Supervisor::configure(const Json::Value &config) {
+    processes_ = config.get("processes", 0).asUInt64();
+    readyTimeout_ = std::chrono::milliseconds(
+        config.get("ready_timeout_ms", (Json::Int64)readyTimeout_.count())
+            .asInt64()
+    );
+    stopTimeout_ = std::chrono::milliseconds(
+        config.get("stop_timeout_ms", (Json::Int64)stopTimeout_.count())
+            .asInt64()
+    );
+    metricsInterval_ = std::chrono::milliseconds(
+        config.get("metrics_interval_ms", (Json::Int64)metricsInterval_.count())
+            .asInt64()
+    );
+    metricsDir_ = config.get("metrics_dir", metricsDir_).asString();
+}
+
+std::optional<int> Supervisor::run() {
+    std::error_code ec;
+    std::filesystem::create_directories(metricsDir_, ec);
+    for (const auto &entry :
+         std::filesystem::directory_iterator(metricsDir_, ec)) {
+        if (entry.path().filename().string().rfind("worker-", 0) == 0) {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+
+    sigset_t mask = supervisorSignals();
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    signalFd_ = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signalFd_ < 0) {
+        LOG_FATAL << "signalfd failed: " << strerror(errno);
+        return 1;
+    }
+
+    // Остальные слоты ждут, пока слот 0 создаст схему и станет готов,
+    // иначе их первые запросы попадут в еще не созданные таблицы.
+    LOG_INFO << "Supervisor: starting " << processes_ << " workers";
+    if (spawn(0)) {
+        return std::nullopt;
+    }
+    bool othersStarted = processes_ == 1;
+    auto firstStarted = Clock::now();
+
+    for (;;) {
+        std::vector<pollfd> fds{{signalFd_, POLLIN, 0}};
+        for (const auto &worker : workers_) {
+            if (worker.readyFd >= 0) {
+                fds.push_back({worker.readyFd, POLLIN, 0});
+            }
+        }
+        poll(fds.data(), fds.size(), 100);
+
+        signalfd_siginfo info;
+        while (read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGHUP) {
+                if (!stopping_ && othersStarted && restartQueue_.empty()) {
+                    LOG_INFO << "Supervisor: rolling restart";
+                    for (size_t slot = 0; slot < processes_; ++slot) {
+                        restartQueue_.push_back(slot);
+                    }
+                }
+            } else if (info.ssi_signo != SIGCHLD && !stopping_) {
+                LOG_INFO << "Supervisor: stopping workers";
+                stopping_ = true;
+                stopDeadline_ = Clock::now() + stopTimeout_;
+                restartQueue_.clear();
+                pendingSpawns_.clear();
+                for (auto &worker : workers_) {
+                    kill(worker.pid, SIGTERM);
+                }
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            for (auto &worker : workers_) {
+                if (worker.readyFd != fds[i].fd) {
+                    continue;
+                }
+                char byte;
+                if (read(worker.readyFd, &byte, 1) == 1) {
+                    worker.ready = true;
+                    LOG_INFO << "Supervisor: worker " << worker.slot
+                             << " (pid " << worker.pid << ") is ready";
+                }
+                close(worker.readyFd);
+                worker.readyFd = -1;
+            }
+        }
+
+        reap();
+        auto now = Clock::now();
+        if (stopping_) {
+            if (workers_.empty()) {
+                LOG_INFO << "Supervisor: all workers stopped";
+                return 0;
+            }
+            if (now > stopDeadline_) {
+                for (auto &worker : workers_) {
+                    kill(worker.pid, SIGKILL);
+                }
+            }
+            continue;
+        }
+
+        if (!othersStarted) {
+            bool firstReady = std::any_of(
+                workers_.begin(), workers_.end(),
+                [](const Worker &w) { return w.slot == 0 && w.ready; }
+            );
+            if (firstReady || now - firstStarted > readyTimeout_) {
+                if (!firstReady) {
+                    LOG_ERROR << "Supervisor: worker 0 was not ready in time, "
+                                 "starting the others anyway";
+                }
+                othersStarted = true;
+                for (size_t slot = 1; slot < processes_; ++slot) {
+                    if (spawn(slot)) {
+                        return std::nullopt;
+                    }
+                }
+            }
+        }
+
+        for (auto &worker : workers_) {
+            if (worker.retiring && now > worker.deadline) {
+                kill(worker.pid, SIGKILL);
+            }
+        }
+        for (size_t i = 0; i < pendingSpawns_.size();) {
+            if (pendingSpawns_[i].second > now) {
+                ++i;
+                continue;
+            }
+            size_t slot = pendingSpawns_[i].first;
+            pendingSpawns_.erase(pendingSpawns_.begin() + i);
+            if (spawn(slot)) {
+                return std::nullopt;
+            }
+        }
+        if (advanceRestart()) {
+            return std::nullopt;
+        }
+    }
+}
+
+bool Supervisor::spawn(size_t slot) {
+    auto now = Clock::now();
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        LOG_ERROR << "Supervisor: pipe failed: " << strerror(errno);
+        pendingSpawns_.emplace_back(slot, now + kCrashBackoff);
+        return false;
+    }
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR << "Supervisor: fork failed: " << strerror(errno);
+        close(fds[0]);
+        close(fds[1]);
+        pendingSpawns_.emplace_back(slot, now + kCrashBackoff);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        close(signalFd_);
+        signalFd_ = -1;
+        for (const auto &worker : workers_) {
+            if (worker.readyFd >= 0) {
+                close(worker.readyFd);
+            }
+        }
+        workers_.clear();
+        restartQueue_.clear();
+        pendingSpawns_.clear();
+        sigset_t mask = supervisorSignals();
+        sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+        // Воркер не переживает supervisor.
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent) {
+            _exit(0);
+        }
+        worker_ = true;
+        slot_ = slot;
+        readyFd_ = fds[1];
+        workerStarted_ = now;
+        return true;
+    }
+    close(fds[1]);
+    Worker worker{pid, slot, fds[0]};
+    worker.started = now;
+    workers_.push_back(worker);
+    LOG_INFO << "Supervisor: worker " << slot << " started, pid " << pid;
+    return false;
+}
+
+Supervisor::Worker *Supervisor::find(pid_t pid) {
+    for (auto &worker : workers_) {
+        if (worker.pid == pid) {
+            return &worker;
+        }
+    }
+    return nullptr;
+}
+
+void Supervisor::reap() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto it = std::find_if(
+            workers_.begin(), workers_.end(),
+            [pid](const Worker &w) { return w.pid == pid; }
+        );
+        if (it == workers_.end()) {
+            continue;
+        }
+        Worker worker = *it;
+        workers_.erase(it);
+        if (worker.readyFd >= 0) {
+            close(worker.readyFd);
+        }
+        if (WIFSIGNALED(status)) {
+            LOG_INFO << "Supervisor: worker " << worker.slot << " (pid " << pid
+                     << ") killed by signal " << WTERMSIG(status);
+        } else {
+            LOG_INFO << "Supervisor: worker " << worker.slot << " (pid " << pid
+                     << ") exited with status " << WEXITSTATUS(status);
+        }
+        if (stopping_ || worker.retiring || pid == replacementPid_) {
+            continue;
+        }
+        bool replaced = std::any_of(
+            workers_.begin(), workers_.end(),
+            [&](const Worker &w) { return w.slot == worker.slot && !w.retiring; }
+        );
+        if (replaced) {
+            continue;
+        }
+        auto now = Clock::now();
+        pendingSpawns_.emplace_back(
+            worker.slot,
+            now - worker.started < kCrashBackoff ? now + kCrashBackoff : now
+        );
+    }
+}
+
+void Supervisor::retire(Worker &worker) {
+    kill(worker.pid, SIGTERM);
+    worker.retiring = true;
+    worker.deadline = Clock::now() + stopTimeout_;
+}
+
+// Слоты перезапускаются по одному, поэтому процессов не больше
+// processes + 1. Новый воркер, не ставший готовым за ready_timeout_ms,
+// останавливается, а перезапуск прерывается: старые воркеры продолжают
+// работать.
+bool Supervisor::advanceRestart() {
+    if (restartQueue_.empty()) {
+        return false;
+    }
+    size_t slot = restartQueue_.front();
+    if (replacementPid_ == 0) {
+        size_t before = workers_.size();
+        if (spawn(slot)) {
+            return true;
+        }
+        if (workers_.size() == before) {
+            // spawn отложил запуск; перезапуск прерывается, слот остается
+            // за старым воркером.
+            LOG_ERROR << "Supervisor: rolling restart aborted at worker "
+                      << slot;
+            std::erase_if(pendingSpawns_, [slot](const auto &pending) {
+                return pending.first == slot;
+            });
+            restartQueue_.clear();
+            return false;
+        }
+        replacementPid_ = workers_.back().pid;
+        return false;
+    }
+
+    Worker *fresh = find(replacementPid_);
+    if (!fresh) {
+        LOG_ERROR << "Supervisor: rolling restart aborted, new worker " << slot
+                  << " exited before it was ready";
+        restartQueue_.clear();
+        replacementPid_ = 0;
+        return false;
+    }
+    if (!fresh->ready) {
+        if (Clock::now() - fresh->started > readyTimeout_) {
+            LOG_ERROR << "Supervisor: rolling restart aborted, new worker "
+                      << slot << " was not ready in time";
+            retire(*fresh);
+            restartQueue_.clear();
+            replacementPid_ = 0;
+        }
+        return false;
+    }
+
+    bool oldAlive = false;
+    for (auto &worker : workers_) {
+        if (worker.slot == slot && worker.pid != replacementPid_) {
+            if (!worker.retiring) {
+                retire(worker);
+            }
+            oldAlive = true;
+        }
+    }
+    if (oldAlive) {
+        return false;
+    }
+    restartQueue_.pop_front();
+    replacementPid_ = 0;
+    if (restartQueue_.empty()) {
+        LOG_INFO << "Supervisor: rolling restart finished";
+    }
+    return false;
+}
+
+void Supervisor::startWorker(trantor::EventLoop *loop) {
+    if (!worker_) {
+        return;
+    }
+    drogon::app().enableReusePort();
+    // Beginning advice выполняется до открытия портов, поэтому готовность
+    // сообщается следующей задачей loop'а.
+    drogon::app().registerBeginningAdvice([this]() {
+        drogon::app().getLoop()->queueInLoop([this]() {
+            listening_ = true;
+            if (readyHolds_ == 0) {
+                reportReady();
+            }
+        });
+    });
+    writeSnapshot();
+    loop->runEvery(
+        std::chrono::duration<double>(metricsInterval_).count(),
+        [this]() { writeSnapshot(); }
+    );
+}
+
+void Supervisor::holdReady() {
+    if (worker_) {
+        ++readyHolds_;
+    }
+}
+
+void Supervisor::releaseReady() {
+    if (!worker_) {
+        return;
+    }
+    drogon::app().getLoop()->queueInLoop([this]() {
+        if (--readyHolds_ == 0 && listening_) {
+            reportReady();
+        }
+    });
+}
+
+void Supervisor::reportReady() {
+    char byte = 1;
+    if (write(readyFd_, &byte, 1) != 1) {
+        LOG_ERROR << "Failed to report readiness to supervisor";
+    }
+    close(readyFd_);
+    readyFd_ = -1;
+}
+
+Json::Value Supervisor::snapshot() {
+    auto live = FeedHub::instance().stats();
+    Json::Value ret;
+    ret["admission"] = AdmissionControl::instance().stats();
+    ret["logging"] = AsyncLog::instance().stats();
+    ret["availability"] = AvailabilityFilter::instance().stats();
+    ret["idempotency"] = IdempotencyStore::instance().stats();
+    ret["media"] = MediaStore::instance().stats();
+    ret["postCache"] = PostCache::instance().stats();
+    ret["singleFlight"] = SingleFlight::instance().stats();
+    ret["tokenCache"] = TokenCache::instance().stats();
+    ret["transfer"] = PostTransfer::instance().stats();
+    ret["live"]["subscribers"] = (Json::UInt64)live.subscribers;
+    ret["live"]["published"] = (Json::UInt64)live.published;
+    ret["live"]["droppedEvents"] = (Json::UInt64)live.droppedEvents;
+    ret["live"]["droppedConnections"] = (Json::UInt64)live.droppedConnections;
+    return ret;
+}
+
+std::string Supervisor::snapshotPath(size_t slot) const {
+    return metricsDir_ + "/worker-" + std::to_string(slot) + ".json";
+}
+
+// Снимок пишется под временным именем и переименовывается, чтобы
+// aggregate() в другом воркере не прочитал его наполовину.
+void Supervisor::writeSnapshot() const {
+    Json::Value doc;
+    doc["slot"] = (Json::UInt64)slot_;
+    doc["pid"] = (Json::Int64)getpid();
+    doc["uptimeSec"] =
+        std::chrono::duration<double>(Clock::now() - workerStarted_).count();
+    doc["writtenAtMs"] = (Json::Int64)nowMs();
+    doc["metrics"] = snapshot();
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    auto path = snapshotPath(slot_);
+    auto tmp = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        file << Json::writeString(builder, doc);
+        if (!file) {
+            LOG_ERROR << "Failed to write worker metrics to " << tmp;
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+}
+
+Json::Value Supervisor::aggregate() const {
+    Json::Value ret;
+    ret["processes"] = (Json::UInt64)processes();
+    Json::Value workers(Json::arrayValue);
+    Json::Value total(Json::objectValue);
+    if (!enabled()) {
+        Json::Value self;
+        self["slot"] = 0;
+        self["pid"] = (Json::Int64)getpid();
+        self["metrics"] = snapshot();
+        sumInto(total, self["metrics"]);
+        workers.append(std::move(self));
+    } else {
+        // Снимок старше трех интервалов принадлежит остановленному воркеру.
+        auto staleBefore = nowMs() - 3 * metricsInterval_.count();
+        Json::CharReaderBuilder builder;
+        std::error_code ec;
+        for (const auto &entry :
+             std::filesystem::directory_iterator(metricsDir_, ec)) {
+            auto name = entry.path().filename().string();
+            if (name.rfind("worker-", 0) != 0 ||
+                entry.path().extension() != ".json") {
+                continue;
+            }
+            std::ifstream file(entry.path());
+            Json::Value doc;
+            std::string errors;
+            if (!Json::parseFromStream(builder, file, &doc, &errors) ||
+                doc["writtenAtMs"].asInt64() < staleBefore) {
+                continue;
+            }
+            sumInto(total, doc["metrics"]);
+            workers.append(std::move(doc));
+        }
+    }
+    ret["reporting"] = workers.size();
+    ret["workers"] = std::move(workers);
+    ret["total"] = std::move(total);
+    return ret;
+}
\ No newline at end of file
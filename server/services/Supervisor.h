@@ -0,0 +1,123 @@
+#pragma once
+#include <json/json.h>
+#include <trantor/net/EventLoop.h>
+#include <sys/types.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Многопроцессный режим: при workers.processes > 0 main становится
+// supervisor'ом и запускает столько же воркеров. Воркер — обычный
+// drogon_app со своими пулами соединений, кешами и аллокатором; порт
+// каждый воркер открывает сам с SO_REUSEPORT, соединения между ними
+// распределяет ядро. Ядра делятся между воркерами, см. Topology.
+//
+// SIGHUP — поочередный перезапуск: новый воркер слота прогревается и
+// открывает порт, только потом старый получает SIGTERM, поэтому порт не
+// остается без слушателя. SIGTERM и SIGINT останавливают все воркеры.
+// Упавший воркер запускается заново.
+//
+// Состояние воркеров не общее: TokenCache каждого воркера живет своим
+// TTL, ReactionBuffer каждого воркера сбрасывает свои реакции, а события
+// /api/posts/live FeedHub разносит через LISTEN/NOTIFY. При processes > 1
+// чтения с реплик выключены (окно read-your-writes было бы своим в каждом
+// воркере), а AvailabilityFilter не строится. DDL, миграцию uuid и чистку
+// idempotency_keys выполняет только слот 0, поэтому при старте остальные
+// слоты запускаются, когда слот 0 готов. Счетчики воркеры пишут в
+// metrics_dir, сумму отдает aggregate().
+class Supervisor {
+public:
+    static Supervisor &instance();
+
+    void configure(const Json::Value &config);
+
+    bool enabled() const {
+        return processes_ > 0;
+    }
+
+    // Вызывается до создания любых потоков. В supervisor возвращает код
+    // выхода после остановки всех воркеров; в воркере возвращает
+    // std::nullopt, и main продолжает обычный запуск.
+    std::optional<int> run();
+
+    // Номер слота воркера и число воркеров; без supervisor'а 0 и 1.
+    size_t slot() const {
+        return slot_;
+    }
+    size_t processes() const {
+        return processes_ > 0 ? processes_ : 1;
+    }
+
+    // В воркере: включает SO_REUSEPORT, сообщает supervisor'у о
+    // готовности после открытия порта и периодически пишет снимок
+    // счетчиков. Вызывается до app().run().
+    void startWorker(trantor::EventLoop *loop);
+
+    // В воркере: готовность не сообщается, пока на каждый holdReady() не
+    // придется свой releaseReady(). releaseReady() можно вызывать из любого
+    // потока. Вне воркера ничего не делают.
+    void holdReady();
+    void releaseReady();
+
+    // Счетчики всех живых воркеров: целые значения суммируются в total,
+    // дробные (доли, задержки) остаются только в снимках воркеров.
+    Json::Value aggregate() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Worker {
+        pid_t pid;
+        size_t slot;
+        int readyFd;
+        bool ready = false;
+        // SIGTERM уже отправлен, замена не нужна.
+        bool retiring = false;
+        Clock::time_point started;
+        Clock::time_point deadline;
+    };
+
+    Supervisor() = default;
+
+    // true в дочернем процессе.
+    bool spawn(size_t slot);
+    void reap();
+    void retire(Worker &worker);
+    // true в дочернем процессе.
+    bool advanceRestart();
+    Worker *find(pid_t pid);
+
+    void reportReady();
+
+    static Json::Value snapshot();
+    void writeSnapshot() const;
+    std::string snapshotPath(size_t slot) const;
+
+    size_t processes_ = 0;
+    std::chrono::milliseconds readyTimeout_{60000};
+    std::chrono::milliseconds stopTimeout_{10000};
+    std::chrono::milliseconds metricsInterval_{1000};
+    std::string metricsDir_ = "/tmp/priyomysh-workers";
+
+    // Только в supervisor'е.
+    int signalFd_ = -1;
+    std::vector<Worker> workers_;
+    std::deque<size_t> restartQueue_;
+    // Новый воркер слота restartQueue_.front(), 0 — еще не запущен.
+    pid_t replacementPid_ = 0;
+    std::vector<std::pair<size_t, Clock::time_point>> pendingSpawns_;
+    bool stopping_ = false;
+    Clock::time_point stopDeadline_;
+
+    // Только в воркере.
+    bool worker_ = false;
+    size_t slot_ = 0;
+    int readyFd_ = -1;
+    // Только в главном loop'е воркера.
+    int readyHolds_ = 0;
+    bool listening_ = false;
+    Clock::time_point workerStarted_;
+};
@@ -0,0 +1,78 @@
+#include "TokenCache.h"
+#include <algorithm>
+#include <functional>
+
+TokenCache &TokenCache::instance() {
+    static TokenCache cache;
+    return cache;
+}
+
+TokenCache::TokenCache() {
+    configure(Json::Value());
+}
+
+void TokenCache::configure(const Json::Value &config) {
+    ttl_ = std::chrono::milliseconds(
+        (int64_t)(config.get("ttl_sec", 30.0).asDouble() * 1000)
+    );
+    size_t maxEntries = config.get("max_entries", 100000).asUInt64();
+    size_t segments =
+        std::max<Json::UInt64>(1, config.get("segments", 16).asUInt64());
+    segmentCapacity_ = std::max<size_t>(1, maxEntries / segments);
+    segments_.clear();
+    for (size_t i = 0; i < segments; ++i) {
+        segments_.push_back(std::make_unique<Segment>());
+    }
+}
+
+TokenCache::Segment &TokenCache::segmentFor(const std::string &login) {
+    return *segments_[std::hash<std::string>{}(login) % segments_.size()];
+}
+
+std::optional<int> TokenCache::get(const std::string &login) {
+    auto &segment = segmentFor(login);
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    auto it = segment.entries.find(login);
+    if (it == segment.entries.end()) {
+        ++misses_;
+        return std::nullopt;
+    }
+    if (it->second.expires <= Clock::now()) {
+        segment.entries.erase(it);
+        ++misses_;
+        return std::nullopt;
+    }
+    ++hits_;
+    return it->second.tokenNumber;
+}
+
+void TokenCache::put(const std::string &login, int tokenNumber) {
+    auto now = Clock::now();
+    auto &segment = segmentFor(login);
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    if (segment.entries.size() >= segmentCapacity_ &&
+        !segment.entries.count(login)) {
+        std::erase_if(segment.entries, [&](const auto &item) {
+            return item.second.expires <= now;
+        });
+        if (segment.entries.size() >= segmentCapacity_) {
+            return;
+        }
+    }
+    segment.entries[login] = Entry{tokenNumber, now + ttl_};
+}
+
+Json::Value TokenCache::stats() const {
+    uint64_t entries = 0;
+    for (const auto &segment : segments_) {
+        std::lock_guard<std::mutex> lock(segment->mutex);
+        entries += segment->entries.size();
+    }
+    uint64_t hits = hits_.load(), misses = misses_.load();
+    Json::Value ret;
+    ret["entries"] = (Json::UInt64)entries;
+    ret["hits"] = (Json::UInt64)hits;
+    ret["misses"] = (Json::UInt64)misses;
+    ret["hitRate"] = hits + misses ? (double)hits / (hits + misses) : 0.0;
+    return ret;
+}
\ No newline at end of file
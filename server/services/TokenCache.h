@@ -0,0 +1,50 @@
+#pragma once
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// token_number пользователей для проверки JWT без запроса в базу на
+// каждый вызов API. Запись живет ttl_sec: на это время отзыв токена может
+// запоздать. Кеш разбит на сегменты со своей блокировкой.
+class TokenCache {
+public:
+    static TokenCache &instance();
+
+    void configure(const Json::Value &config);
+
+    std::optional<int> get(const std::string &login);
+    void put(const std::string &login, int tokenNumber);
+
+    Json::Value stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        int tokenNumber;
+        Clock::time_point expires;
+    };
+
+    struct Segment {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    TokenCache();
+
+    Segment &segmentFor(const std::string &login);
+
+    Clock::duration ttl_ = std::chrono::seconds(30);
+    size_t segmentCapacity_ = 0;
+    std::vector<std::unique_ptr<Segment>> segments_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
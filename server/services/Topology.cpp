@@ -0,0 +1,159 @@
+#include "Topology.h"
+#include <drogon/drogon.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <thread>
+
+Topology &Topology::instance() {
+    static Topology topology;
+    return topology;
+}
+
+static std::vector<int> affinityCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        unsigned n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < n; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Квота в ядрах: cpu.max в cgroup v2 или cfs_quota_us/cfs_period_us в v1.
+static std::optional<double> cgroupQuota() {
+    std::ifstream v2("/sys/fs/cgroup/cpu.max");
+    std::string quota;
+    double period = 0;
+    if (v2 >> quota >> period) {
+        if (quota == "max" || period <= 0) {
+            return std::nullopt;
+        }
+        return std::stod(quota) / period;
+    }
+    std::ifstream quotaFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream periodFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    double quotaUs = 0, periodUs = 0;
+    if (quotaFile >> quotaUs && periodFile >> periodUs && quotaUs > 0 &&
+        periodUs > 0) {
+        return quotaUs / periodUs;
+    }
+    return std::nullopt;
+}
+
+void Topology::configure(
+    const Json::Value &config,
+    size_t process,
+    size_t processes
+) {
+    cpus_ = affinityCpus();
+    quota_ = cgroupQuota();
+    double cores = cpus_.size();
+    if (quota_) {
+        cores = std::min(cores, *quota_);
+    }
+    effectiveCores_ = std::max(1, (int)std::ceil(cores / processes));
+
+    // По умолчанию четверть ядер уходит под CPU-работу, остальное под IO.
+    int cpuThreads = config.get("cpu_threads", 0).asInt();
+    if (cpuThreads <= 0) {
+        cpuThreads = std::max(1, effectiveCores_ / 4);
+    }
+    int ioThreads = config.get("io_threads", 0).asInt();
+    if (ioThreads <= 0) {
+        ioThreads = std::max(1, effectiveCores_ - cpuThreads);
+    }
+    cpuThreads_ = cpuThreads;
+    ioThreads_ = ioThreads;
+
+    pin_ = config.get("pin_threads", false).asBool();
+    // Воркер закрепляет потоки только за своим отрезком ядер.
+    if (processes > 1) {
+        size_t share = cpus_.size() / processes;
+        if (share > 0) {
+            cpus_ = std::vector<int>(
+                cpus_.begin() + process * share,
+                cpus_.begin() + (process + 1) * share
+            );
+        } else {
+            pin_ = false;
+        }
+    }
+    if (pin_ && ioThreads_ + cpuThreads_ > cpus_.size()) {
+        LOG_WARN << "pin_threads ignored: " << ioThreads_ + cpuThreads_
+                 << " threads for " << cpus_.size() << " cpus";
+        pin_ = false;
+    }
+}
+
+void Topology::apply() {
+    drogon::app().setThreadNum(ioThreads_);
+
+    cpuPool_ =
+        std::make_unique<trantor::EventLoopThreadPool>(cpuThreads_, "CpuPool");
+    cpuPool_->start();
+
+    if (pin_) {
+        auto cpuLoops = cpuPool_->getLoops();
+        for (size_t i = 0; i < cpuLoops.size(); ++i) {
+            pin(cpuLoops[i], cpus_[ioThreads_ + i]);
+        }
+        // IO loop'ы drogon создаются в run(), поэтому закрепляются в
+        // beginning advice.
+        drogon::app().registerBeginningAdvice([this]() {
+            auto ioLoops = drogon::app().getIOLoops();
+            for (size_t i = 0; i < ioLoops.size() && i < cpus_.size(); ++i) {
+                pin(ioLoops[i], cpus_[i]);
+            }
+        });
+    }
+
+    LOG_INFO << "Topology: " << cpus_.size() << " cpus, quota "
+             << (quota_ ? std::to_string(*quota_) : "none") << ", "
+             << ioThreads_ << " io threads, " << cpuThreads_
+             << " cpu threads, pinning " << (pin_ ? "on" : "off");
+}
+
+void Topology::pin(trantor::EventLoop *loop, int cpu) {
+    loop->queueInLoop([cpu]() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            LOG_WARN << "Failed to pin thread to cpu " << cpu << ": " << err;
+        }
+    });
+}
+
+trantor::EventLoop *Topology::cpuLoop() {
+    return cpuPool_->getLoop(nextCpuLoop_++ % cpuThreads_);
+}
+
+Json::Value Topology::describe() const {
+    Json::Value ret;
+    Json::Value cpus(Json::arrayValue);
+    for (int cpu : cpus_) {
+        cpus.append(cpu);
+    }
+    ret["cpus"] = std::move(cpus);
+    ret["quota"] = quota_ ? Json::Value(*quota_) : Json::Value();
+    ret["effectiveCores"] = effectiveCores_;
+    ret["ioThreads"] = (Json::UInt64)ioThreads_;
+    ret["cpuThreads"] = (Json::UInt64)cpuThreads_;
+    ret["pinned"] = pin_;
+    return ret;
+}
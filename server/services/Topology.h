@@ -0,0 +1,50 @@
+#pragma once
+#include <trantor/net/EventLoop.h>
+#include <trantor/net/EventLoopThreadPool.h>
+#include <json/json.h>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Раскладка потоков по ядрам. Число IO loop'ов и CPU-потоков (bcrypt,
+// base64, хеши картинок) выводится из доступных ядер с учетом affinity
+// процесса и квоты cgroup. При pin_threads каждый IO loop закрепляется за
+// своим ядром, а CPU-пул получает оставшиеся ядра.
+class Topology {
+public:
+    static Topology &instance();
+
+    // Определяет ядра и квоту и считает размеры пулов. В многопроцессном
+    // режиме (см. Supervisor) воркер process из processes получает свою
+    // долю ядер.
+    void configure(
+        const Json::Value &config,
+        size_t process = 0,
+        size_t processes = 1
+    );
+
+    // Задает число IO потоков drogon и запускает CPU-пул. Вызывается до
+    // app().run().
+    void apply();
+
+    // Loop CPU-пула для тяжелой работы, по кругу.
+    trantor::EventLoop *cpuLoop();
+
+    Json::Value describe() const;
+
+private:
+    Topology() = default;
+
+    static void pin(trantor::EventLoop *loop, int cpu);
+
+    std::vector<int> cpus_;
+    std::optional<double> quota_;
+    int effectiveCores_ = 1;
+    size_t ioThreads_ = 1;
+    size_t cpuThreads_ = 1;
+    bool pin_ = false;
+
+    std::unique_ptr<trantor::EventLoopThreadPool> cpuPool_;
+    std::atomic<size_t> nextCpuLoop_{0};
+};
@@ -0,0 +1,209 @@
+#include "Warmup.h"
+#include <drogon/drogon.h>
+#include <future>
+#include "db/ShardRouter.h"
+#include "services/PostCache.h"
+#include "services/TokenCache.h"
+
+Warmup &Warmup::instance() {
+    static Warmup warmup;
+    return warmup;
+}
+
+void Warmup::configure(const Json::Value &config) {
+    enabled_ = config.get("enabled", enabled_).asBool();
+    timeBudget_ = std::chrono::milliseconds(
+        config.get("time_budget_ms", (Json::Int64)timeBudget_.count())
+            .asInt64()
+    );
+    maxBytes_ = config.get("max_bytes", (Json::UInt64)maxBytes_).asUInt64();
+    feedPosts_ = config.get("feed_pages", 5).asUInt64() *
+                 config.get("page_size", 20).asUInt64();
+    hotPosts_ = config.get("hot_posts", (Json::UInt64)hotPosts_).asUInt64();
+    hotWindowHours_ = config.get("hot_window_hours", hotWindowHours_).asInt();
+    activeUsers_ =
+        config.get("active_users", (Json::UInt64)activeUsers_).asUInt64();
+    activeWindowHours_ =
+        config.get("active_window_hours", activeWindowHours_).asInt();
+}
+
+bool Warmup::outOfTime() const {
+    return Clock::now() >= deadline_;
+}
+
+void Warmup::progress(const std::string &step) {
+    double elapsedMs =
+        std::chrono::duration<double, std::milli>(Clock::now() - started_)
+            .count();
+    std::lock_guard<std::mutex> lock(mutex_);
+    step_ = step;
+    durationMs_ = elapsedMs;
+    LOG_INFO << "warmup: " << step << ", posts " << posts_ << ", "
+             << bytes_ / 1024 << " KB, tokens " << tokens_ << ", "
+             << (int64_t)elapsedMs << " ms";
+}
+
+template <typename... Arguments>
+std::optional<drogon::orm::Result> Warmup::query(
+    const TimedDbClientPtr &db,
+    const std::string &sql,
+    Arguments &&...args
+) {
+    // Обработчики могут сработать после выхода по таймауту, поэтому
+    // promise живет в shared_ptr.
+    using Outcome = std::optional<drogon::orm::Result>;
+    auto promise = std::make_shared<std::promise<Outcome>>();
+    auto future = promise->get_future();
+    db->execSqlAsync(
+        sql,
+        [promise](const drogon::orm::Result &r) { promise->set_value(r); },
+        [this, promise](const drogon::orm::DrogonDbException &e) {
+            LOG_ERROR << "warmup query failed: " << e.base().what();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++failures_;
+            }
+            promise->set_value(std::nullopt);
+        },
+        std::forward<Arguments>(args)...
+    );
+    if (future.wait_until(deadline_) != std::future_status::ready) {
+        LOG_WARN << "warmup: query did not finish within the time budget";
+        return std::nullopt;
+    }
+    return future.get();
+}
+
+bool Warmup::warmPosts(const drogon::orm::Result &rows) {
+    for (const auto &row : rows) {
+        if (outOfTime()) {
+            return false;
+        }
+        if (!seen_.insert(row["id_uuid"].as<std::string>()).second) {
+            continue;
+        }
+        // Картинки читаются с диска и кодируются прямо во фрагмент.
+        auto fragment = PostCache::instance().fragment(row);
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++posts_;
+        bytes_ += fragment->size();
+        if (bytes_ >= maxBytes_) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Warmup::run() {
+    if (!enabled_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = "disabled";
+        return;
+    }
+    started_ = Clock::now();
+    deadline_ = started_ + timeBudget_;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = "running";
+    }
+    LOG_INFO << "warmup: started, budget " << timeBudget_.count() << " ms, "
+             << maxBytes_ / 1024 << " KB";
+
+    static const std::string feedSql = R"sql(
+        SELECT p.id_uuid, p.version, p.content, p.author,
+               epoch_us(p.created_at) as created_at_us,
+               (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+               (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images
+        FROM posts p
+        JOIN users u ON u.login = p.author
+        WHERE u.is_public = true
+        ORDER BY p.created_at DESC, p.id_uuid DESC
+        LIMIT $1
+    )sql";
+    static const std::string hotSql = R"sql(
+        SELECT p.id_uuid, p.version, p.content, p.author,
+               epoch_us(p.created_at) as created_at_us,
+               (SELECT string_agg(tag, ',') FROM tags WHERE id_post = p.id) as tags1,
+               (SELECT string_agg(img, ',') FROM media WHERE id_post = p.id) as images
+        FROM post_reaction_counts c
+        JOIN posts p ON p.id = c.post_id
+        JOIN users u ON u.login = p.author
+        WHERE u.is_public = true
+          AND p.created_at > now() - make_interval(hours => $1::int)
+        ORDER BY c.likes + c.dislikes DESC
+        LIMIT $2
+    )sql";
+    static const std::string tokensSql = R"sql(
+        SELECT login, token_number FROM users
+        WHERE login IN (
+            SELECT DISTINCT author FROM posts
+            WHERE created_at > now() - make_interval(hours => $1::int)
+        )
+        LIMIT $2
+    )sql";
+
+    // Лента и популярные посты собираются со всех шардов, как и в
+    // обработчиках. Запросы прогрева встают в очередь primary после DDL
+    // из setupDatabase.
+    auto primaries = ShardRouter::instance().primaries();
+    bool withinBudget = true;
+    for (size_t i = 0; i < primaries.size() && withinBudget; ++i) {
+        auto shard = "shard " + std::to_string(i);
+        if (auto r = query(primaries[i], feedSql, std::to_string(feedPosts_))) {
+            withinBudget = warmPosts(*r);
+        }
+        progress(shard + " feed");
+        if (!withinBudget) {
+            break;
+        }
+        if (auto r = query(
+                primaries[i], hotSql, std::to_string(hotWindowHours_),
+                std::to_string(hotPosts_)
+            )) {
+            withinBudget = warmPosts(*r);
+        }
+        progress(shard + " hot posts");
+    }
+    for (size_t i = 0; i < primaries.size() && !outOfTime(); ++i) {
+        if (auto r = query(
+                primaries[i], tokensSql, std::to_string(activeWindowHours_),
+                std::to_string(activeUsers_)
+            )) {
+            for (const auto &row : *r) {
+                TokenCache::instance().put(
+                    row["login"].as<std::string>(),
+                    row["token_number"].as<int>()
+                );
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            tokens_ += r->size();
+        }
+        progress("shard " + std::to_string(i) + " tokens");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = outOfTime()            ? "time_budget_exceeded"
+             : bytes_ >= maxBytes_ ? "memory_budget_exceeded"
+                                   : "done";
+    durationMs_ =
+        std::chrono::duration<double, std::milli>(Clock::now() - started_)
+            .count();
+    LOG_INFO << "warmup: " << state_ << " in " << (int64_t)durationMs_
+             << " ms, posts " << posts_ << ", " << bytes_ / 1024
+             << " KB, tokens " << tokens_;
+}
+
+Json::Value Warmup::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Json::Value ret;
+    ret["state"] = state_;
+    ret["step"] = step_;
+    ret["durationMs"] = durationMs_;
+    ret["posts"] = (Json::UInt64)posts_;
+    ret["bytes"] = (Json::UInt64)bytes_;
+    ret["tokens"] = (Json::UInt64)tokens_;
+    ret["failures"] = (Json::UInt64)failures_;
+    ret["timeBudgetMs"] = (Json::Int64)timeBudget_.count();
+    ret["maxBytes"] = (Json::UInt64)maxBytes_;
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+#include <json/json.h>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include "db/TimedDbClient.h"
+
+// Прогрев кешей после setupDatabase и до app().run(): свежие страницы
+// публичной ленты и популярные посты попадают в PostCache вместе с
+// картинками, token_number активных пользователей — в TokenCache.
+// Прогрев ограничен по времени и по объему фрагментов; пока он идет,
+// сервер не принимает соединения, поэтому выкатка может ждать открытия
+// порта. Ход прогрева пишется в лог и отдается в /api/debug/warmup.
+class Warmup {
+public:
+    static Warmup &instance();
+
+    void configure(const Json::Value &config);
+
+    // Блокирует вызывающий поток до конца прогрева или до исчерпания
+    // бюджета времени.
+    void run();
+
+    Json::Value stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // std::nullopt при ошибке запроса или по истечении бюджета.
+    template <typename... Arguments>
+    std::optional<drogon::orm::Result> query(
+        const TimedDbClientPtr &db,
+        const std::string &sql,
+        Arguments &&...args
+    );
+
+    // Кладет посты в PostCache; false, если бюджет исчерпан.
+    bool warmPosts(const drogon::orm::Result &rows);
+
+    bool outOfTime() const;
+    void progress(const std::string &step);
+
+    bool enabled_ = false;
+    std::chrono::milliseconds timeBudget_{10000};
+    size_t maxBytes_ = 64 * 1024 * 1024;
+    size_t feedPosts_ = 100;
+    size_t hotPosts_ = 200;
+    int hotWindowHours_ = 24;
+    size_t activeUsers_ = 10000;
+    int activeWindowHours_ = 24;
+
+    Clock::time_point deadline_;
+    Clock::time_point started_;
+    // Лента и популярные посты пересекаются.
+    std::unordered_set<std::string> seen_;
+
+    mutable std::mutex mutex_;
+    std::string state_ = "pending";
+    std::string step_;
+    double durationMs_ = 0;
+    uint64_t posts_ = 0;
+    uint64_t bytes_ = 0;
+    uint64_t tokens_ = 0;
+    uint64_t failures_ = 0;
+};